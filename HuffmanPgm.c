@@ -2,185 +2,249 @@
 #include <stdlib.h>
 #include <string.h>
 #include "huffpgm.h"
-
-#define MAX_SIZE 256
-#define MAX_LINE 1024
-
-int compressHuffman(const char* inputFile, const char* outputFile) {
-    FILE* input = fopen(inputFile, "rb");
-    FILE* output = fopen(outputFile, "wb");
-    if (!input || !output) {
-        printf("Cannot open the file");
+#include "pgmstream.h"
+
+// Adaptive mode: the code length cap, then the rows coded in one pass as
+// they are read, with no frequency count beforehand.
+static int encodeAdaptivePGM(PGMReader* reader, FILE* output, int maxLength) {
+    unsigned char cap = (unsigned char)maxLength;
+    if (fwrite(&cap, 1, 1, output) != 1) return 1;
+
+    long bR = pgmBatchRows(reader); // batchRows
+    unsigned char* iD = (unsigned char*)malloc(bR * reader->pgm.width); // imageData
+    HuffAdaptive* model = (HuffAdaptive*)malloc(sizeof(HuffAdaptive));
+    BitWriter bw;
+    if (!iD || !model || bit_writer_init(&bw, output) != 0) {
+        printf("Memory allocation failed\n");
+        free(iD);
+        free(model);
         return 1;
     }
+    huff_adaptive_init(model, maxLength, 0);
 
-    PGMHeader pgm;
-    char line[MAX_LINE];
-    if (!readLine(input, line, MAX_LINE) || sscanf(line, "%2s", pgm.sign) != 1) {
-        printf("Failed to read magic number\n");
-        fclose(input);
-        fclose(output);
-        return 1;
+    long rows;
+    const unsigned char* view;
+    startPGMReadAhead(reader, bR);
+    while ((rows = viewPGMRows(reader, iD, bR, &view)) > 0) {
+        huff_adaptive_encode(model, view, (size_t)rows * reader->pgm.width, &bw);
     }
-    if (!readLine(input, line, MAX_LINE) || sscanf(line, "%d %d", &pgm.width, &pgm.height) != 2) {
-        printf("Failed to read dimensions\n");
-        fclose(input);
-        fclose(output);
+    int failed = rows < 0 || bit_writer_flush(&bw) != 0;
+    bit_writer_free(&bw);
+    free(model);
+    free(iD);
+    return failed;
+}
+
+int compressHuffman(const char* inputFile, const char* outputFile, int mode, int maxLength) {
+    if (mode != HUFF_MODE_FREQ && mode != HUFF_MODE_ANS && mode != HUFF_MODE_CONTEXT &&
+        (maxLength < HUFF_MIN_LIMIT || maxLength > HUFF_MAX_LIMIT)) {
+        printf("Maximum code length must be between %d and %d bits\n", HUFF_MIN_LIMIT, HUFF_MAX_LIMIT);
         return 1;
     }
-    if (!readLine(input, line, MAX_LINE) || sscanf(line, "%d", &pgm.maxIntensity) != 1) {
-        printf("Failed to read maxval\n");
-        fclose(input);
-        fclose(output);
+    PGMReader reader;
+    if (openPGMReader(&reader, inputFile) != 0) {
         return 1;
     }
-    
-    if ((strcmp(pgm.sign, "P2") != 0 && strcmp(pgm.sign, "P5") != 0) || pgm.maxIntensity > 255) {
-        printf("Unsupported PGM format: %s, maxval: %d\n", pgm.sign, pgm.maxIntensity);
-        fclose(input);
-        fclose(output);
+    FILE* output = open_output_stream(outputFile);
+    if (!output) {
+        printf("Cannot open the file");
+        closePGMReader(&reader);
         return 1;
     }
+    PGMHeader pgm = reader.pgm;
+    long size = pgmFileSize(&reader);
 
-    long tP = (long)pgm.width * pgm.height; // totalPixels
-    unsigned char* iD = (unsigned char*)malloc(tP); // imageData
-    if (!iD) {
-        printf("Memory allocation failed\n");
-        fclose(input);
+    unsigned char version = HUFF_VERSION;
+    unsigned char modeByte = (unsigned char)mode;
+    if (fwrite(&pgm.width, sizeof(int), 1, output) != 1 ||
+        fwrite(&pgm.height, sizeof(int), 1, output) != 1 ||
+        fwrite(pgm.sign, sizeof(char), 2, output) != 2 ||
+        fwrite(HUFF_MAGIC, 1, HUFF_MAGIC_BYTES, output) != HUFF_MAGIC_BYTES ||
+        fwrite(&version, 1, 1, output) != 1 ||
+        fwrite(&modeByte, 1, 1, output) != 1) {
+        printf("Failed to write header\n");
+        closePGMReader(&reader);
         fclose(output);
         return 1;
     }
-
-    if (strcmp(pgm.sign, "P2") == 0) {
-        for (long i = 0; i < tP; i++) {
-            int pixel;
-            if (fscanf(input, "%d", &pixel) != 1) {
-                printf("Error reading P2 data at pixel %ld\n", i);
-                free(iD);
-                fclose(input);
-                fclose(output);
-                return 1;
-            }
-            iD[i] = (unsigned char)pixel;
-        }
-    } else {
-        if (fread(iD, 1, tP, input) != tP) {
-            printf("Error reading P5 data\n");
-            free(iD);
-            fclose(input);
-            fclose(output);
+    if (mode == HUFF_MODE_ADAPTIVE) {
+        int failed = encodeAdaptivePGM(&reader, output, maxLength);
+        long compressedSize = stream_size(output);
+        closePGMReader(&reader);
+        fclose(output);
+        if (failed) {
+            printf("Failed to write compressed data\n");
             return 1;
         }
+        print_compression_report(size, compressedSize);
+        return 0;
     }
-    fseek(input, 0, SEEK_END);
-    long size = ftell(input);
-    fseek(input, sizeof(pgm), SEEK_SET);
-    fclose(input);
 
-    unsigned int freq[MAX_SIZE] = {0};
-    for (long i = 0; i < tP; i++) {
-        freq[iD[i]]++;
+    // Two passes over the rows: one for the histogram, one to encode. Blocks
+    // are coded in parallel from the whole image, so it is read once and
+    // kept in memory for both.
+    int blocks = mode == HUFF_MODE_BLOCKS || mode == HUFF_MODE_STREAMS || mode == HUFF_MODE_ANS ||
+                 mode == HUFF_MODE_CONTEXT;
+    long bR = blocks ? pgm.height : pgmBatchRows(&reader); // batchRows
+    unsigned char* iD = (unsigned char*)malloc(bR * pgm.width); // imageData, one batch of rows
+    if (!iD) {
+        printf("Memory allocation failed\n");
+        closePGMReader(&reader);
+        fclose(output);
+        return 1;
     }
 
-    Node* root = buildHuffmanTree(freq);
-    if (!root) {
-        printf("Failed to build Huffman tree during compression\n");
+    if (!blocks && keepPGMInput(&reader) != 0) {
         free(iD);
+        closePGMReader(&reader);
         fclose(output);
         return 1;
     }
 
-    char codes[MAX_SIZE][MAX_SIZE] = {0};
-    int lengths[MAX_SIZE] = {0};
-    char code[MAX_SIZE];
-    generateCodes(root, code, 0, codes, lengths);
-
-    if (fwrite(&pgm.width, sizeof(int), 1, output) != 1 ||
-        fwrite(&pgm.height, sizeof(int), 1, output) != 1 ||
-        fwrite(pgm.sign, sizeof(char), 2, output) != 2) {
-        printf("Failed to write header\n");
+    unsigned int freq[MAX_SIZE] = {0};
+    long rows;
+    const unsigned char* view;
+    reader.hist = freq;
+    if (blocks) {
+        rows = viewPGMRows(&reader, iD, bR, &view) == bR ? bR : -1;
+    } else {
+        startPGMReadAhead(&reader, bR);
+        while ((rows = viewPGMRows(&reader, iD, bR, &view)) > 0);
+    }
+    reader.hist = NULL;
+    if (rows < 0 || (!blocks && rewindPGMReader(&reader) != 0)) {
         free(iD);
-        freeHuffmanTree(root);
+        closePGMReader(&reader);
         fclose(output);
         return 1;
     }
 
-    for (int i = 0; i < MAX_SIZE; i++) {
-        if (freq[i] > 0) {
-            if (fwrite(&i, sizeof(unsigned char), 1, output) != 1 ||
-                fwrite(&freq[i], sizeof(unsigned int), 1, output) != 1) {
-                printf("Failed to write frequency table\n");
-                free(iD);
-                freeHuffmanTree(root);
-                fclose(output);
-                return 1;
+    if (mode == HUFF_MODE_ANS || mode == HUFF_MODE_CONTEXT) {
+        // The context models come from a pass of their own over the image
+        int count = mode == HUFF_MODE_ANS ? 1 : ANS_CONTEXTS; // models
+        AnsModel* models = (AnsModel*)malloc(count * sizeof(AnsModel));
+        const char* error = NULL;
+        if (!models) {
+            error = "Memory allocation failed";
+        } else if (mode == HUFF_MODE_ANS) {
+            if (ans_model_build(models, freq) != 0) {
+                error = "No pixel data to compress";
+            } else if (ans_write_model(output, models) != 0 ||
+                       ans_blocks_encode(view, pgm.width, pgm.width, pgm.height, models, output) != 0) {
+                error = "Failed to write compressed data";
+            }
+        } else {
+            if (ans_context_models(models, view, pgm.width, pgm.width, pgm.height, 1) != 0) {
+                error = pgm.width > 0 && pgm.height > 0 ? "Memory allocation failed" : "No pixel data to compress";
+            } else if (ans_write_context_models(output, models) != 0 ||
+                       ans_context_blocks_encode(view, pgm.width, pgm.width, pgm.height, 1, models, output) != 0) {
+                error = "Failed to write compressed data";
             }
         }
+        long compressedSize = stream_size(output);
+        closePGMReader(&reader);
+        fclose(output);
+        free(models);
+        free(iD);
+        if (error) {
+            printf("%s\n", error);
+            return 1;
+        }
+        print_compression_report(size, compressedSize);
+        return 0;
     }
-    unsigned char zero = 0;
-    if (fwrite(&zero, 1, 1, output) != 1) {
-        printf("Failed to write frequency table end marker\n");
+
+    // The frequency table is turned back into a tree on decode, the way the
+    // original coder paired the nodes
+    HuffTree tree;
+    if ((mode == HUFF_MODE_FREQ ? huff_tree_build_heap(&tree, freq) : huff_tree_build(&tree, freq)) != 0) {
+        printf("Failed to build Huffman tree during compression\n");
         free(iD);
-        freeHuffmanTree(root);
+        closePGMReader(&reader);
         fclose(output);
         return 1;
     }
 
-    unsigned int bitBuffer = 0;
-    int bits = 0;
-    for (long i = 0; i < tP; i++) {
-        unsigned char pixel = iD[i];
-        for (int j = 0; j < lengths[pixel]; j++) {
-            bitBuffer = (bitBuffer << 1) | (codes[pixel][j] - '0');
-            bits++;
-            if (bits == 8) {
-                unsigned char byte = (unsigned char)bitBuffer;
-                if (fwrite(&byte, 1, 1, output) != 1) {
-                    printf("Failed to write compressed data\n");
+    uint64_t codes[MAX_SIZE];
+    int lengths[MAX_SIZE];
+    huff_tree_codes(&tree, codes, lengths);
+    if (mode != HUFF_MODE_FREQ) {
+        huff_limit_lengths(freq, lengths, maxLength);
+        huff_canonical_codes(lengths, codes);
+        if (huff_write_lengths(output, freq, lengths) != 0) {
+            printf("Failed to write code length table\n");
+            free(iD);
+            closePGMReader(&reader);
+            fclose(output);
+            return 1;
+        }
+    } else {
+        for (int i = 0; i < MAX_SIZE; i++) {
+            if (freq[i] > 0) {
+                if (fwrite(&i, sizeof(unsigned char), 1, output) != 1 ||
+                    fwrite(&freq[i], sizeof(unsigned int), 1, output) != 1) {
+                    printf("Failed to write frequency table\n");
                     free(iD);
-                    freeHuffmanTree(root);
+                    closePGMReader(&reader);
                     fclose(output);
                     return 1;
                 }
-                bitBuffer = 0;
-                bits = 0;
             }
         }
+        unsigned char zero = 0;
+        if (fwrite(&zero, 1, 1, output) != 1) {
+            printf("Failed to write frequency table end marker\n");
+            free(iD);
+            closePGMReader(&reader);
+            fclose(output);
+            return 1;
+        }
     }
-    if (bits > 0) {
-        bitBuffer <<= (8 - bits);
-        unsigned char byte = (unsigned char)bitBuffer;
-        if (fwrite(&byte, 1, 1, output) != 1) {
-            printf("Failed to write final compressed byte\n");
+
+    int failed = 0;
+    if (blocks) {
+        failed = huff_blocks_encode(view, pgm.width, pgm.width, pgm.height,
+                                    mode == HUFF_MODE_STREAMS ? HUFF_STREAMS : 1, codes, lengths, output) != 0;
+    } else {
+        BitWriter bw;
+        if (bit_writer_init(&bw, output) != 0) {
+            printf("Memory allocation failed\n");
             free(iD);
-            freeHuffmanTree(root);
+            closePGMReader(&reader);
             fclose(output);
             return 1;
         }
+        startPGMReadAhead(&reader, bR);
+        while ((rows = viewPGMRows(&reader, iD, bR, &view)) > 0) {
+            long n = rows * pgm.width;
+            for (long i = 0; i < n; i++) {
+                bit_writer_put(&bw, codes[view[i]], lengths[view[i]]);
+            }
+        }
+        failed = rows < 0 || bit_writer_flush(&bw) != 0;
+        bit_writer_free(&bw);
     }
+    if (failed) {
+        printf("Failed to write compressed data\n");
+        free(iD);
+        closePGMReader(&reader);
+        fclose(output);
+        return 1;
+    }
+    long compressedSize = stream_size(output);
 
+    closePGMReader(&reader);
     fclose(output);
     free(iD);
-    freeHuffmanTree(root);
 
-    printf("Original size: %ld bytes\n", size);
-
-    FILE *check_size = fopen("compressed.bin", "rb");
-    fseek(check_size, 0, SEEK_END);
-    long compressed_size = ftell(check_size);
-    fclose(check_size);
-    
-    printf("Compressed size: %ld bytes\n", compressed_size);
-    printf("Compression ratio: %.2f%%\n", 
-           (1.0 - ((float)compressed_size / size)) * 100); 
+    print_compression_report(size, compressedSize);
 
     return 0;
 }
 
 int decompressHuffman(const char* inputFile, const char* outputFile) {
-    FILE* input = fopen(inputFile, "rb");
-    FILE* output = fopen(outputFile, "wb");
-    if (!input || !output) {
+    FILE* input = open_input_stream(inputFile);
+    if (!input) {
         printf("Cannot open the file");
         return 1;
     }
@@ -190,142 +254,177 @@ int decompressHuffman(const char* inputFile, const char* outputFile) {
         fread(&pgm.height, sizeof(int), 1, input) != 1 ||
         fread(pgm.sign, sizeof(char), 2, input) != 2) {
         printf("Failed to read header\n");
-        fclose(input);
-        fclose(output);
+        close_stream(input);
         return 1;
     }
     pgm.sign[2] = '\0';
     pgm.maxIntensity = 255;
 
-    long tP = (long)pgm.width * pgm.height; // totalPixels
-    unsigned char* dD = (unsigned char*)malloc(tP); // decompressedData
-    if (!dD) {
-        printf("Memory allocation failed\n");
-        fclose(input);
-        fclose(output);
-        return 1;
-    }
-
-    unsigned int freq[MAX_SIZE] = {0};
-    unsigned char value;
-    int freqCount = 0;
-    while (fread(&value, 1, 1, input) == 1) {
-        if (value == 0) break; 
-        unsigned int f;
-        if (fread(&f, sizeof(unsigned int), 1, input) != 1) {
-            printf("Error reading frequency value for byte %d\n", value);
-            free(dD);
-            fclose(input);
-            fclose(output);
-            return 1;
+    // A frequency table never starts with a zero byte, so a table right
+    // after the header (no marker) or after a zero mode byte (no magic)
+    // is an older stream and decodes as HUFF_MODE_FREQ.
+    unsigned char mode = HUFF_MODE_FREQ;
+    int c = getc(input);
+    if (c == 0) {
+        c = getc(input);
+        if (c == 0) {
+            unsigned char marker[HUFF_MAGIC_BYTES - 2], version;
+            if (fread(marker, 1, sizeof(marker), input) != sizeof(marker) ||
+                memcmp(marker, HUFF_MAGIC + 2, sizeof(marker)) != 0 ||
+                fread(&version, 1, 1, input) != 1 || version != HUFF_VERSION ||
+                fread(&mode, 1, 1, input) != 1 || mode > HUFF_MODE_CONTEXT) {
+                printf("Unknown Huffman table format\n");
+                close_stream(input);
+                return 1;
+            }
+            c = EOF;
         }
-        freq[value] = f;
-        freqCount++;
-    }
-    if (freqCount == 0) {
-        printf("No frequency data found in compressed file\n");
-        free(dD);
-        fclose(input);
-        fclose(output);
-        return 1;
     }
+    if (c != EOF) ungetc(c, input);
 
-    Node* root = buildHuffmanTree(freq);
-    if (!root) {
-        printf("Failed to rebuild Huffman tree\n");
-        free(dD);
-        fclose(input);
-        fclose(output);
+    long tP = (long)pgm.width * pgm.height; // totalPixels
+    PGMOutput out;
+    if (openPGMOutput(&out, outputFile, &pgm) != 0) {
+        close_stream(input);
         return 1;
     }
 
-    Node* current = root;
-    unsigned char byte;
-    long pW = 0; // pixelsWritten
-    int bits = 0;
-    while (pW < tP) {
-        if (bits == 0) {
-            if (fread(&byte, 1, 1, input) != 1) {
-                printf("Unexpected end of file at pixel %ld\n", pW);
-                break;
-            }
-            bits = 8;
+    HuffDecoder dec;
+    AnsModel* ansModels = NULL;
+    HuffAdaptive* model = NULL;
+    unsigned char cap;
+    if (mode == HUFF_MODE_ANS || mode == HUFF_MODE_CONTEXT) {
+        ansModels = (AnsModel*)malloc((mode == HUFF_MODE_ANS ? 1 : ANS_CONTEXTS) * sizeof(AnsModel));
+        if (!ansModels || (mode == HUFF_MODE_ANS ? ans_read_model(input, ansModels)
+                                                 : ans_read_context_models(input, ansModels)) != 0) {
+            printf(ansModels ? "Invalid frequency table\n" : "Memory allocation failed\n");
+            free(ansModels);
+            discardPGMOutput(&out);
+            close_stream(input);
+            return 1;
         }
-        int bit = (byte >> (bits - 1)) & 1;
-        bits--;
-
-        if (bit) {
-            if (!current->right) {
-                printf("Invalid Huffman code at pixel %ld\n", pW);
-                free(dD);
-                freeHuffmanTree(root);
-                fclose(input);
-                fclose(output);
-                return 1;
-            }
-            current = current->right;
-        } else {
-            if (!current->left) {
-                printf("Invalid Huffman code at pixel %ld\n", pW);
-                free(dD);
-                freeHuffmanTree(root);
-                fclose(input);
-                fclose(output);
+    } else if (mode == HUFF_MODE_ADAPTIVE) {
+        model = (HuffAdaptive*)malloc(sizeof(HuffAdaptive));
+        if (fread(&cap, 1, 1, input) != 1 || cap < HUFF_MIN_LIMIT || cap > HUFF_MAX_LIMIT || !model) {
+            printf("Invalid adaptive Huffman header\n");
+            free(model);
+            discardPGMOutput(&out);
+            close_stream(input);
+            return 1;
+        }
+        huff_adaptive_init(model, cap, 1);
+    } else if (mode != HUFF_MODE_FREQ) {
+        if (huff_read_lengths(input, &dec) != 0) {
+            printf("Invalid code length table\n");
+            discardPGMOutput(&out);
+            close_stream(input);
+            return 1;
+        }
+    } else {
+        unsigned int freq[MAX_SIZE] = {0};
+        unsigned char value;
+        int freqCount = 0;
+        while (fread(&value, 1, 1, input) == 1) {
+            if (value == 0) break; 
+            unsigned int f;
+            if (fread(&f, sizeof(unsigned int), 1, input) != 1) {
+                printf("Error reading frequency value for byte %d\n", value);
+                discardPGMOutput(&out);
+                close_stream(input);
                 return 1;
             }
-            current = current->left;
+            freq[value] = f;
+            freqCount++;
         }
-
-        if (!current->left && !current->right) {
-            dD[pW++] = current->data;
-            current = root;
+        if (freqCount == 0) {
+            printf("No frequency data found in compressed file\n");
+            discardPGMOutput(&out);
+            close_stream(input);
+            return 1;
         }
-    }
-    fclose(input);
 
-    if (pW != tP) {
-        printf("Error: Decompressed pixel count (%ld) doesn't match expected (%ld)\n",
-               pW, tP);
-        free(dD);
-        freeHuffmanTree(root);
-        fclose(output);
-        return 1;
+        HuffTree tree;
+        if (huff_tree_build_heap(&tree, freq) != 0 || huff_decoder_from_tree(&dec, &tree) != 0) {
+            printf("Invalid Huffman code table\n");
+            discardPGMOutput(&out);
+            close_stream(input);
+            return 1;
+        }
     }
 
-    fprintf(output, "%s\n%d %d\n%d\n", pgm.sign, pgm.width, pgm.height, pgm.maxIntensity);
-    if (strcmp(pgm.sign, "P2") == 0) {
-        for (long i = 0; i < tP; i++) {
-            if (fprintf(output, "%d", dD[i]) < 0) {
-                printf("Error writing P2 data at pixel %ld\n", i);
-                fclose(output);
-                free(dD);
-                freeHuffmanTree(root);
-                return 1;
-            }
-            if ((i + 1) % pgm.width == 0) fprintf(output, "\n");
-            else fprintf(output, " ");
+    long pW; // pixelsWritten
+    int overrun = 0;
+    int blocks = mode == HUFF_MODE_BLOCKS || mode == HUFF_MODE_STREAMS || mode == HUFF_MODE_ANS ||
+                 mode == HUFF_MODE_CONTEXT;
+    if (blocks) {
+        // The block offsets only mean something once all of it is in, and
+        // the blocks are decoded in parallel over the whole image
+        size_t cS; // compressedSize
+        unsigned char* cD = read_remaining(input, &cS); // compressedData
+        close_stream(input);
+        unsigned char* dD = pgmOutputPixels(&out, 0, tP); // decompressedData
+        if (!cD || !dD) {
+            printf("Memory allocation failed\n");
+            free(ansModels);
+            free(cD);
+            discardPGMOutput(&out);
+            return 1;
+        }
+        if (mode == HUFF_MODE_ANS) {
+            pW = ans_blocks_decode(cD, cS, ansModels, dD, pgm.width, pgm.width, pgm.height) == 0 ? tP : 0;
+        } else if (mode == HUFF_MODE_CONTEXT) {
+            pW = ans_context_blocks_decode(cD, cS, ansModels, 1, dD, pgm.width, pgm.width, pgm.height) == 0 ? tP : 0;
+        } else {
+            pW = huff_blocks_decode(cD, cS, mode == HUFF_MODE_STREAMS ? HUFF_STREAMS : 1, &dec,
+                                    dD, pgm.width, pgm.width, pgm.height) == 0 ? tP : 0;
         }
+        free(ansModels);
+        free(cD);
     } else {
-        if (fwrite(dD, 1, tP, output) != tP) {
-            printf("Error writing P5 data\n");
-            fclose(output);
-            free(dD);
-            freeHuffmanTree(root);
+        // The codes are decoded row by row as they are read in
+        BitReader br;
+        if (bit_reader_open(&br, input) != 0) {
+            printf("Memory allocation failed\n");
+            free(model);
+            discardPGMOutput(&out);
+            close_stream(input);
             return 1;
         }
+        for (pW = 0; pW < tP;) {
+            unsigned char* row = pgmOutputPixels(&out, pW, pgm.width);
+            long got = model ? (long)huff_adaptive_decode(model, &br, row, pgm.width)
+                             : (long)huff_decode_run(&dec, &br, row, pgm.width);
+            pW += got;
+            if (got != pgm.width) break;
+        }
+        free(model);
+        overrun = bit_reader_overrun(&br);
+        bit_reader_close(&br);
+        close_stream(input);
+    }
+    if (pW < tP && blocks) {
+        printf("Invalid Huffman block data\n");
+    } else if (pW < tP) {
+        printf("Invalid Huffman code at pixel %ld\n", pW);
+    } else if (overrun) {
+        printf("Unexpected end of file\n");
     }
 
-    fclose(output);
-    free(dD);
-    freeHuffmanTree(root);
-    return 0;
+    if (pW != tP || overrun) {
+        printf("Error: Decompressed pixel count (%ld) doesn't match expected (%ld)\n",
+               pW, tP);
+        discardPGMOutput(&out);
+        return 1;
+    }
+
+    return closePGMOutput(&out);
 }
 
 int huffman() {
     char inputFile[256];
-    char compressedFile[256] = "compressed.bin";
+    char compressedFile[256];
     char decompressedFile[256];
-    int yn;
+    int yn, mode, maxLength = HUFF_MAX_LIMIT;
 
     printf("What do you want to do??\n1.Compress an image.\n2.Decompress an image.\n");
     printf("Enter your choice in number: ");  
@@ -337,10 +436,28 @@ int huffman() {
         scanf("%255s", inputFile);
         printf("\n");
 
+        printf("Enter the compressed file name: ");
+        scanf("%255s", compressedFile);
+        printf("\n");
+
+        printf("Which Huffman mode??\n1.Frequency table.\n2.Canonical codes.\n3.Canonical codes, blocks coded in parallel.\n4.Canonical codes, parallel blocks of four interleaved streams.\n5.Adaptive codes, single pass.\n6.Asymmetric numeral systems (rANS) instead of Huffman codes.\n7.rANS, tables chosen by the neighbouring pixels.\n");
+        printf("Enter your choice in number: ");
+        scanf("%d", &mode);
+        printf("\n");
+        if (mode < 1 || mode > 7) {
+            printf("Invalid choice.\n");
+            return 0;
+        }
+        if (mode > 1 && mode < 6) {
+            printf("Enter the maximum code length in bits (%d-%d): ", HUFF_MIN_LIMIT, HUFF_MAX_LIMIT);
+            scanf("%d", &maxLength);
+            printf("\n");
+        }
+
         printf("Attempting to compress %s...\n", inputFile);
         printf("\n");
 
-        if (compressHuffman(inputFile, compressedFile) == 0) {
+        if (compressHuffman(inputFile, compressedFile, mode - 1, maxLength) == 0) {
             printf("Compression successful: %s -> %s\n", inputFile, compressedFile);
 
         } else {
@@ -348,6 +465,9 @@ int huffman() {
         }
     }
     else if(yn == 2){ 
+        printf("Enter the compressed file name: ");
+        scanf("%255s", compressedFile);
+        printf("\n");
         printf("Enter decompressed PGM file name: ");
         scanf("%255s", decompressedFile);
         printf("\n");
@@ -358,18 +478,10 @@ int huffman() {
         if (decompressHuffman(compressedFile, decompressedFile) == 0) {
             printf("Decompression successful: %s -> %s\n", compressedFile, decompressedFile);
 
-            FILE* comp = fopen(compressedFile, "rb");
-            fseek(comp, 0, SEEK_END);
-            long compSize = ftell(comp);
-            fclose(comp);
-        
-            FILE* decomp = fopen(decompressedFile, "rb");
-            fseek(decomp, 0, SEEK_END);
-            long decompSize = ftell(decomp);
-            fclose(decomp);
-
-            printf("Compressed size: %ld bytes\n", compSize);
-            printf("Decompressed size: %ld bytes\n", decompSize);
+            long compSize = path_size(compressedFile);
+            long decompSize = path_size(decompressedFile);
+            if (compSize >= 0) printf("Compressed size: %ld bytes\n", compSize);
+            if (decompSize >= 0) printf("Decompressed size: %ld bytes\n", decompSize);
         } else {
             printf("Decompression failed\n");
         }
@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include "image.h"
+#include "bmpsource.h"
+#include "bmpsink.h"
 
 typedef struct {
     unsigned char count; 
@@ -9,139 +11,164 @@ typedef struct {
 } RLEEntry; 
 
 int compressBMP(const char* inputFile, const char* outputFile) {
-    FILE *in = fopen(inputFile, "rb");
-    FILE *out = fopen(outputFile, "wb");
-    if (!in || !out) {
+    BmpSource src;
+    if (bmp_source_open(&src, inputFile) != 0) {
+        return 1;
+    }
+    // The pixels are read in place, so the rows must really be 3 bytes a pixel
+    if (src.info.BitCount != 24) {
+        printf("Error: Only 24-bit BMP supported\n");
+        bmp_source_close(&src);
+        return 1;
+    }
+    FILE *out = open_output_stream(outputFile);
+    if (!out) {
         printf("Error opening files\n");
+        bmp_source_close(&src);
         return 1;
     }
 
-    BmpFile file;
-    BmpInfo info;
-    fread(&file, sizeof(BmpFile), 1, in);
-    fread(&info, sizeof(BmpInfo), 1, in);
-    
+    BmpFile file = src.file;
+    BmpInfo info = src.info;
+
     info.Compression = 1;
     
     fwrite(&file, sizeof(BmpFile), 1, out);
     fwrite(&info, sizeof(BmpInfo), 1, out);
 
-    int padding = (4 - ((info.Width * 3) % 4)) % 4;
-    int rowSize = info.Width * 3 + padding;
-    
-    fseek(in, file.Offbits, SEEK_SET);
-    unsigned char* pD = malloc(rowSize * info.Height); // pixel data
-    fread(pD, 1, rowSize * info.Height, in);
+    BitWriter bw;
+    if (bit_writer_init(&bw, out) != 0) {
+        printf("Error: Memory allocation failed\n");
+        bmp_source_close(&src);
+        fclose(out);
+        return 1;
+    }
 
     RLEEntry entry = {0, 0, 0, 0};
     unsigned long cS = 0; // compressed size
-    
-    for (int i = 0; i < info.Height * rowSize; i += 3) {
-        if (i % rowSize >= info.Width * 3) continue;
-        unsigned char b = pD[i];
-        unsigned char g = pD[i + 1];
-        unsigned char r = pD[i + 2];
-        if (entry.count == 0) {
-            entry.count = 1;
-            entry.b = b;
-            entry.g = g;
-            entry.r = r;
-        }
-        else if (entry.b == b && entry.g == g && entry.r == r && entry.count < 255) {
-            entry.count++;
-        }
-        else {
-            fwrite(&entry, sizeof(RLEEntry), 1, out);
-            cS += sizeof(RLEEntry);
-            entry.count = 1;
-            entry.b = b;
-            entry.g = g;
-            entry.r = r;
+
+    // Rows are walked in place in stored order, so the padding after each
+    // row is stepped over and never looked at
+    for (size_t y = 0; y < src.rows; y++) {
+        const unsigned char* pD = bmp_source_row(&src, y); // pixel data
+        for (size_t i = 0; i < src.row_bytes; i += 3) {
+            unsigned char b = pD[i];
+            unsigned char g = pD[i + 1];
+            unsigned char r = pD[i + 2];
+            if (entry.count == 0) {
+                entry.count = 1;
+                entry.b = b;
+                entry.g = g;
+                entry.r = r;
+            }
+            else if (entry.b == b && entry.g == g && entry.r == r && entry.count < 255) {
+                entry.count++;
+            }
+            else {
+                bit_writer_bytes(&bw, &entry, sizeof(RLEEntry));
+                cS += sizeof(RLEEntry);
+                entry.count = 1;
+                entry.b = b;
+                entry.g = g;
+                entry.r = r;
+            }
         }
     }
     if (entry.count > 0) {
-        fwrite(&entry, sizeof(RLEEntry), 1, out);
+        bit_writer_bytes(&bw, &entry, sizeof(RLEEntry));
         cS += sizeof(RLEEntry);
     }
-    fseek(out, 0, SEEK_SET);
+    int write_failed = bit_writer_flush(&bw);
+    bit_writer_free(&bw);
+    if (write_failed) {
+        printf("Error: Failed to write compressed data\n");
+        bmp_source_close(&src);
+        fclose(out);
+        return 1;
+    }
+    long compressed_size = stream_size(out);
+    // The file size goes into the header afterwards, unless the output is a
+    // pipe, which the decoder does not mind
     file.Size = sizeof(BmpFile) + sizeof(BmpInfo) + cS;
-    fwrite(&file, sizeof(BmpFile), 1, out);
+    if (fseek(out, 0, SEEK_SET) == 0) {
+        fwrite(&file, sizeof(BmpFile), 1, out);
+    }
 
-    fseek(in, 0, SEEK_END);
-    long size = ftell(in);
-    fseek(in, sizeof(BmpFile), SEEK_SET);
+    long size = is_std_stream(inputFile) ? -1 : (long)src.map.size;
 
-    free(pD);
-    fclose(in);
+    bmp_source_close(&src);
     fclose(out);
 
-    printf("\nOriginal size: %ld bytes\n", size);
-    
-    FILE *check_size = fopen("compressed.bin", "rb");
-    fseek(check_size, 0, SEEK_END);
-    long compressed_size = ftell(check_size);
-    fclose(check_size);
-    
-    printf("Compressed size: %ld bytes\n", compressed_size);
-    printf("Compression ratio: %.2f%%\n", (1.0 - ((float)compressed_size / size)) * 100); 
+    printf("\n");
+    print_compression_report(size, compressed_size);
 
     return 0;
 }
 
 int decompressBMP(const char* inputFile, const char* outputFile) {
-    FILE *in = fopen(inputFile, "rb");
-    FILE *out = fopen(outputFile, "wb");
-    if (!in || !out) {
+    FILE* in = open_input_stream(inputFile);
+    if (!in) {
         printf("Error opening files\n");
         return 1;
     }
 
     BmpFile file;
     BmpInfo info;
-    fread(&file, sizeof(BmpFile), 1, in);
-    fread(&info, sizeof(BmpInfo), 1, in);
-    
+    if (fread(&file, sizeof(BmpFile), 1, in) != 1 || fread(&info, sizeof(BmpInfo), 1, in) != 1) {
+        printf("Error: Failed to read BMP headers\n");
+        close_stream(in);
+        return 1;
+    }
+    if (info.Width <= 0 || info.BitCount != 24) {
+        printf("Error: Invalid RLE header\n");
+        close_stream(in);
+        return 1;
+    }
+
     info.Compression = 0;
-    info.SizeImage = info.Width * info.Height * 3;
-    
-    fwrite(&file, sizeof(BmpFile), 1, out);
-    fwrite(&info, sizeof(BmpInfo), 1, out);
+    info.SizeImage = (unsigned int)(bmp_stride(&info) * bmp_rows(&info));
+    file.Offbits = sizeof(BmpFile) + sizeof(BmpInfo);
+    file.Size = (unsigned int)(file.Offbits + bmp_stride(&info) * bmp_rows(&info));
+
+    // Runs are expanded straight into the rows of the output file as they
+    // are read in
+    BmpSink dst;
+    if (bmp_sink_open(&dst, outputFile, &file, &info) != 0) {
+        close_stream(in);
+        return 1;
+    }
 
-    int padding = (4 - ((info.Width * 3) % 4)) % 4;
-    int rowSize = info.Width * 3 + padding;
-    unsigned char* row = calloc(rowSize, 1);
-
-    int Count = 0;
-    RLEEntry entry;
-    while (fread(&entry, sizeof(RLEEntry), 1, in) == 1) {
-        for (int i = 0; i < entry.count; i++) {
-            int pos = (Count % info.Width) * 3;
-            row[pos] = entry.b;
-            row[pos + 1] = entry.g;
-            row[pos + 2] = entry.r;
-            
-            Count++;
-            if (Count % info.Width == 0) {
-                fwrite(row, 1, rowSize, out);
-                memset(row, 0, rowSize);
+    size_t x = 0, y = 0;
+    unsigned char* row = bmp_sink_row(&dst, 0);
+    RLEEntry entries[4096];
+    size_t got;
+    while (y < dst.rows && (got = fread(entries, sizeof(RLEEntry), 4096, in)) > 0) {
+        for (size_t e = 0; e < got && y < dst.rows; e++) {
+            RLEEntry entry = entries[e];
+            for (int i = 0; i < entry.count && y < dst.rows; i++) {
+                row[x * 3] = entry.b;
+                row[x * 3 + 1] = entry.g;
+                row[x * 3 + 2] = entry.r;
+                if (++x == (size_t)info.Width) {
+                    x = 0;
+                    if (++y < dst.rows) row = bmp_sink_row(&dst, y);
+                }
             }
         }
     }
-    fseek(out, 0, SEEK_SET);
-    file.Size = sizeof(BmpFile) + sizeof(BmpInfo) + (rowSize * info.Height);
-    file.Offbits = 54;
-    fwrite(&file, sizeof(BmpFile), 1, out);
+    close_stream(in);
 
-    free(row);
-    fclose(in);
-    fclose(out);
-
-    return 0;
+    if (y != dst.rows) {
+        printf("Error: Decompressed row count (%zu) doesn't match expected (%zu)\n", y, dst.rows);
+        bmp_sink_discard(&dst);
+        return 1;
+    }
+    return bmp_sink_close(&dst) != 0;
 }
 
 int runlengthBmp() {
     char inputFile[256];
-    char compressedFile[256] = "compressed.bin";
+    char compressedFile[256];
     char decompressedFile[256];
     int yn;
 
@@ -154,6 +181,10 @@ int runlengthBmp() {
         scanf("%255s", inputFile);
         printf("\n");
 
+        printf("Enter the compressed file name: ");
+        scanf("%255s", compressedFile);
+        printf("\n");
+
         printf("Attempting to compress %s...\n", inputFile);
         if (compressBMP(inputFile, compressedFile) == 0) {
             printf("Compression successful: %s -> %s\n", inputFile, compressedFile);
@@ -163,6 +194,9 @@ int runlengthBmp() {
         }
     }
     else if(yn == 2){ 
+        printf("Enter the compressed file name: ");
+        scanf("%255s", compressedFile);
+        printf("\n");
         printf("Enter decompressed BMP file name: ");
         scanf("%255s", decompressedFile);
         printf("\n");
@@ -171,18 +205,10 @@ int runlengthBmp() {
         if (decompressBMP(compressedFile, decompressedFile) == 0) {
             printf("Decompression successful: %s -> %s\n", compressedFile, decompressedFile);
 
-            FILE* comp = fopen(compressedFile, "rb");
-            fseek(comp, 0, SEEK_END);
-            long compSize = ftell(comp);
-            fclose(comp);
-        
-            FILE* decomp = fopen(decompressedFile, "rb");
-            fseek(decomp, 0, SEEK_END);
-            long decompSize = ftell(decomp);
-            fclose(decomp);
-
-            printf("Compressed size: %ld bytes\n", compSize);
-            printf("Decompressed size: %ld bytes\n", decompSize);
+            long compSize = path_size(compressedFile);
+            long decompSize = path_size(decompressedFile);
+            if (compSize >= 0) printf("Compressed size: %ld bytes\n", compSize);
+            if (decompSize >= 0) printf("Decompressed size: %ld bytes\n", decompSize);
         } else {
             printf("Decompression failed\n");
         }
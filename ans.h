@@ -0,0 +1,570 @@
+#ifndef ANS_H
+#define ANS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parallel.h"
+
+#define ANS_PROB_BITS 12
+#define ANS_PROB_SCALE (1 << ANS_PROB_BITS)
+#define ANS_LOW (1u << 23) // the coder state stays in [ANS_LOW, ANS_LOW << 8)
+#define ANS_BLOCK_BYTES (1 << 18) // input bytes per block
+#define ANS_CONTEXTS 8            // models to choose from with context coding
+
+// Byte-oriented rANS coder. Symbol probabilities are quantized to
+// multiples of 1/ANS_PROB_SCALE, so a skewed distribution costs close to
+// its entropy instead of at least one bit a symbol as with Huffman codes.
+// Decoding a symbol is one lookup of the low bits of the state in the slot
+// table, one multiply and at most a couple of byte reads.
+typedef struct {
+    uint16_t freq[256];
+    uint16_t cum[257];
+    uint32_t slot[ANS_PROB_SCALE]; // for decoding: symbol, freq - 1 and slot - cum of each slot
+} AnsModel;
+
+// Fills in cum and the slot table from freq, which must add up to
+// ANS_PROB_SCALE. Returns -1 if it does not.
+int ans_model_finish(AnsModel* m) {
+    m->cum[0] = 0;
+    for (int s = 0; s < 256; s++) {
+        if (m->cum[s] + m->freq[s] > ANS_PROB_SCALE) return -1;
+        m->cum[s + 1] = (uint16_t)(m->cum[s] + m->freq[s]);
+        for (uint32_t k = 0; k < m->freq[s]; k++) {
+            m->slot[m->cum[s] + k] = (uint32_t)s | ((uint32_t)(m->freq[s] - 1) << 8) | (k << 20);
+        }
+    }
+    return m->cum[256] == ANS_PROB_SCALE ? 0 : -1;
+}
+
+// Quantizes symbol counts to frequencies adding up to ANS_PROB_SCALE. Every
+// symbol that occurs keeps a frequency of at least 1; the rounding error is
+// taken from, or given to, the most frequent symbols. Returns -1 if no
+// symbol occurs.
+int ans_model_build(AnsModel* m, const unsigned int* counts) {
+    uint64_t total = 0;
+    for (int s = 0; s < 256; s++) {
+        total += counts[s];
+    }
+    if (total == 0) return -1;
+
+    int sum = 0, largest = 0;
+    for (int s = 0; s < 256; s++) {
+        uint64_t f = counts[s] ? (uint64_t)counts[s] * ANS_PROB_SCALE / total : 0;
+        if (counts[s] && f == 0) f = 1;
+        m->freq[s] = (uint16_t)f;
+        sum += (int)f;
+        if (m->freq[s] > m->freq[largest]) largest = s;
+    }
+    while (sum > ANS_PROB_SCALE) {
+        int top = largest;
+        for (int s = 0; s < 256; s++) {
+            if (m->freq[s] > m->freq[top]) top = s;
+        }
+        m->freq[top]--;
+        sum--;
+    }
+    m->freq[largest] = (uint16_t)(m->freq[largest] + ANS_PROB_SCALE - sum);
+    return ans_model_finish(m);
+}
+
+// Frequency table: first and last used symbol, then the frequency of every
+// symbol in that range as uint16.
+int ans_write_model(FILE* file, const AnsModel* m) {
+    int lo = 0, hi = 255;
+    while (lo < 255 && m->freq[lo] == 0) lo++;
+    while (hi > lo && m->freq[hi] == 0) hi--;
+    unsigned char range[2] = { (unsigned char)lo, (unsigned char)hi };
+    if (fwrite(range, 1, 2, file) != 2) return -1;
+    return fwrite(m->freq + lo, sizeof(uint16_t), hi - lo + 1, file) == (size_t)(hi - lo + 1) ? 0 : -1;
+}
+
+int ans_read_model(FILE* file, AnsModel* m) {
+    unsigned char range[2];
+    if (fread(range, 1, 2, file) != 2 || range[1] < range[0]) return -1;
+    memset(m->freq, 0, sizeof(m->freq));
+    size_t n = range[1] - range[0] + 1;
+    if (fread(m->freq + range[0], sizeof(uint16_t), n, file) != n) return -1;
+    return ans_model_finish(m);
+}
+
+// Codes symbol s into the state, writing whole bytes backwards from *p.
+static inline void ans_encode_symbol(uint32_t* x, unsigned char** p, const AnsModel* m, int s) {
+    uint32_t freq = m->freq[s];
+    uint32_t limit = ((ANS_LOW >> ANS_PROB_BITS) << 8) * freq;
+    while (*x >= limit) {
+        *--*p = (unsigned char)*x;
+        *x >>= 8;
+    }
+    *x = ((*x / freq) << ANS_PROB_BITS) + (*x % freq) + m->cum[s];
+}
+
+// rANS decodes the symbols in the opposite order to the encoder, so a
+// block is coded from its last byte to its first and the bytes are written
+// from the end of the buffer backwards; the final states go in front.
+// Decoding then runs forwards through the block. Even and odd columns are
+// coded with two separate states that share the byte stream, so the
+// decoder has two independent symbols in flight instead of waiting on
+// each state update in turn.
+typedef struct {
+    const unsigned char* in;
+    unsigned char* out;
+    size_t rowBytes;
+    size_t stride;            // distance between rows, in the input when
+    size_t blockRows;         // encoding and in the output when decoding
+    size_t rows;
+    size_t step;              // context coding: bytes from a sample to its left neighbour
+    const AnsModel* model;    // one, or ANS_CONTEXTS with context coding
+    unsigned char** blocks;   // encoded blocks, as allocated
+    unsigned char** starts;   // where the bytes of each block start
+    size_t* sizes;
+    const uint64_t* offsets;  // block boundaries in the input when decoding
+    unsigned int (*counts)[ANS_CONTEXTS][256]; // context histograms, one set per block
+    int* failed;
+} AnsBlockJob;
+
+static inline uint32_t ans_block_rows(size_t rowBytes) {
+    size_t rows = rowBytes ? ANS_BLOCK_BYTES / rowBytes : 1;
+    return rows ? (uint32_t)rows : 1;
+}
+
+// Predicts a sample from its left, upper and upper-left neighbours a, b
+// and d with the median edge detector of LOCO-I: a + b - d, kept between
+// a and b.
+static inline int ans_predict(int a, int b, int d) {
+    int hi = a > b ? a : b;
+    int lo = a < b ? a : b;
+    int p = a + b - d;
+    p = p < hi ? p : hi;
+    return p > lo ? p : lo;
+}
+
+// As ans_predict for the sample at row[c], whose neighbours are step bytes
+// apart. Off the left edge the upper neighbour stands in for the others;
+// up is NULL on the first row of a block, which is coded without looking
+// at the block before it.
+static inline int ans_predict_at(const unsigned char* row, const unsigned char* up, size_t c, size_t step) {
+    if (!up) return c >= step ? row[c - step] : 0;
+    if (c < step) return up[c];
+    return ans_predict(row[c - step], up[c], up[c - step]);
+}
+
+// Context of a sample below b: the gradient along the row above, from the
+// upper-left neighbour d through b to the upper-right one e, quantized to
+// its bit length. It leaves out the row being coded, so the decoder can
+// look up the next model while the sample before is still being finished.
+static inline int ans_context(int d, int b, int e) {
+    unsigned int g = (unsigned int)(abs(b - d) + abs(e - b));
+    int k = 31 - __builtin_clz(2 * g + 1);
+    return k < ANS_CONTEXTS - 1 ? k : ANS_CONTEXTS - 1;
+}
+
+// As ans_context for the sample at column c of a row rowBytes long below
+// up, with neighbours step bytes apart. Off the edges of the row b stands
+// in for the missing neighbour, and the first row of a block is all in
+// context 0.
+static inline int ans_context_at(const unsigned char* up, size_t c, size_t step, size_t rowBytes) {
+    if (!up) return 0;
+    return ans_context(c >= step ? up[c - step] : up[c], up[c], c + step < rowBytes ? up[c + step] : up[c]);
+}
+
+// Sets up an encoder buffer for block i, big enough for its n rows: a
+// symbol never takes more than ANS_PROB_BITS bits.
+static unsigned char* ans_block_buffer(AnsBlockJob* job, int i, size_t n, size_t* cap) {
+    *cap = n * job->rowBytes * 2 + 16;
+    unsigned char* buffer = malloc(*cap);
+    if (!buffer) job->failed[i] = 1;
+    return buffer;
+}
+
+// Puts the final states in front of the bytes of block i, which start at p.
+static void ans_block_finish(AnsBlockJob* job, int i, unsigned char* buffer, size_t cap,
+                             unsigned char* p, const uint32_t* x) {
+    p -= 8;
+    for (int k = 0; k < 8; k++) {
+        p[k] = (unsigned char)(x[k >> 2] >> (8 * (k & 3)));
+    }
+    job->blocks[i] = buffer;
+    job->starts[i] = p;
+    job->sizes[i] = (size_t)(buffer + cap - p);
+}
+
+// Reads the two states at the start of block i. Returns -1 if the block
+// is too short to hold them.
+static int ans_block_start(AnsBlockJob* job, int i, const unsigned char** p, const unsigned char** end,
+                           uint32_t* x0, uint32_t* x1) {
+    *p = job->in + job->offsets[i];
+    *end = job->in + job->offsets[i + 1];
+    if (*end - *p < 8) {
+        job->failed[i] = 1;
+        return -1;
+    }
+    const unsigned char* q = *p;
+    *x0 = (uint32_t)q[0] | ((uint32_t)q[1] << 8) | ((uint32_t)q[2] << 16) | ((uint32_t)q[3] << 24);
+    *x1 = (uint32_t)q[4] | ((uint32_t)q[5] << 8) | ((uint32_t)q[6] << 16) | ((uint32_t)q[7] << 24);
+    *p += 8;
+    return 0;
+}
+
+static void ans_block_encode_task(void* ctx, int i) {
+    AnsBlockJob* job = (AnsBlockJob*)ctx;
+    size_t first = (size_t)i * job->blockRows;
+    size_t n = job->rows - first < job->blockRows ? job->rows - first : job->blockRows;
+    size_t cap;
+    unsigned char* buffer = ans_block_buffer(job, i, n, &cap);
+    if (!buffer) return;
+
+    unsigned char* p = buffer + cap;
+    uint32_t x[2] = { ANS_LOW, ANS_LOW };
+    for (size_t y = first + n; y-- > first;) {
+        const unsigned char* row = job->in + y * job->stride;
+        for (size_t c = job->rowBytes; c-- > 0;) {
+            ans_encode_symbol(&x[c & 1], &p, job->model, row[c]);
+        }
+    }
+    ans_block_finish(job, i, buffer, cap, p, x);
+}
+
+// Decodes the symbol in the low bits of x and takes it out of the state,
+// which then needs renormalizing.
+static inline unsigned char ans_decode_symbol(uint32_t* x, const AnsModel* m) {
+    uint32_t e = m->slot[*x & (ANS_PROB_SCALE - 1)];
+    *x = (((e >> 8) & 0xFFF) + 1) * (*x >> ANS_PROB_BITS) + (e >> 20);
+    return (unsigned char)e;
+}
+
+static void ans_block_decode_task(void* ctx, int i) {
+    AnsBlockJob* job = (AnsBlockJob*)ctx;
+    size_t first = (size_t)i * job->blockRows;
+    size_t n = job->rows - first < job->blockRows ? job->rows - first : job->blockRows;
+    const AnsModel* m = job->model;
+    const unsigned char *p, *end;
+    uint32_t x0, x1;
+    if (ans_block_start(job, i, &p, &end, &x0, &x1) != 0) return;
+
+    for (size_t y = first; y < first + n; y++) {
+        unsigned char* row = job->out + y * job->stride;
+        size_t c = 0;
+        // A state never needs more than two bytes after a symbol, so the
+        // bounds only have to be watched near the end of the block
+        for (; c + 2 <= job->rowBytes && end - p >= 4; c += 2) {
+            row[c] = ans_decode_symbol(&x0, m);
+            row[c + 1] = ans_decode_symbol(&x1, m);
+            while (x0 < ANS_LOW) x0 = (x0 << 8) | *p++;
+            while (x1 < ANS_LOW) x1 = (x1 << 8) | *p++;
+        }
+        for (; c < job->rowBytes; c++) {
+            uint32_t x = c & 1 ? x1 : x0;
+            row[c] = ans_decode_symbol(&x, m);
+            while (x < ANS_LOW) {
+                if (p == end) {
+                    job->failed[i] = 1;
+                    return;
+                }
+                x = (x << 8) | *p++;
+            }
+            if (c & 1) x1 = x;
+            else x0 = x;
+        }
+    }
+    // The encoder started from ANS_LOW and used every byte
+    job->failed[i] = x0 != ANS_LOW || x1 != ANS_LOW || p != end;
+}
+
+static void ans_context_count_task(void* ctx, int i) {
+    AnsBlockJob* job = (AnsBlockJob*)ctx;
+    size_t first = (size_t)i * job->blockRows;
+    size_t n = job->rows - first < job->blockRows ? job->rows - first : job->blockRows;
+    unsigned int (*counts)[256] = job->counts[i];
+    memset(counts, 0, sizeof(job->counts[i]));
+    for (size_t y = first; y < first + n; y++) {
+        const unsigned char* row = job->in + y * job->stride;
+        const unsigned char* up = y > first ? row - job->stride : NULL;
+        for (size_t c = 0; c < job->rowBytes; c++) {
+            int k = ans_context_at(up, c, job->step, job->rowBytes);
+            counts[k][(unsigned char)(row[c] - ans_predict_at(row, up, c, job->step))]++;
+        }
+    }
+}
+
+static void ans_context_encode_task(void* ctx, int i) {
+    AnsBlockJob* job = (AnsBlockJob*)ctx;
+    size_t first = (size_t)i * job->blockRows;
+    size_t n = job->rows - first < job->blockRows ? job->rows - first : job->blockRows;
+    size_t cap;
+    unsigned char* buffer = ans_block_buffer(job, i, n, &cap);
+    if (!buffer) return;
+
+    unsigned char* p = buffer + cap;
+    uint32_t x[2] = { ANS_LOW, ANS_LOW };
+    for (size_t y = first + n; y-- > first;) {
+        const unsigned char* row = job->in + y * job->stride;
+        const unsigned char* up = y > first ? row - job->stride : NULL;
+        for (size_t c = job->rowBytes; c-- > 0;) {
+            int k = ans_context_at(up, c, job->step, job->rowBytes);
+            unsigned char e = (unsigned char)(row[c] - ans_predict_at(row, up, c, job->step));
+            ans_encode_symbol(&x[c & 1], &p, job->model + k, e);
+        }
+    }
+    ans_block_finish(job, i, buffer, cap, p, x);
+}
+
+// Reads bytes into a state until it is back in range, at most two, which
+// the caller makes sure are there. Whether a byte is needed is no more
+// predictable than the data, so it is worked out with masks, not branches.
+static inline void ans_renormalize(uint32_t* x, const unsigned char** p) {
+    for (int i = 0; i < 2; i++) {
+        uint32_t need = 0u - (uint32_t)(*x < ANS_LOW);
+        *x = (((*x << 8) | **p) & need) | (*x & ~need);
+        *p += need & 1;
+    }
+}
+
+// Decodes the sample at row[c] of a context-coded block with the state
+// for its column. Returns -1 if the block runs out of bytes.
+static inline int ans_context_decode_at(const AnsBlockJob* job, unsigned char* row, const unsigned char* up,
+                                        size_t c, uint32_t* x0, uint32_t* x1,
+                                        const unsigned char** p, const unsigned char* end) {
+    int k = ans_context_at(up, c, job->step, job->rowBytes);
+    uint32_t x = c & 1 ? *x1 : *x0;
+    row[c] = (unsigned char)(ans_decode_symbol(&x, job->model + k) + ans_predict_at(row, up, c, job->step));
+    while (x < ANS_LOW) {
+        if (*p == end) return -1;
+        x = (x << 8) | *(*p)++;
+    }
+    if (c & 1) *x1 = x;
+    else *x0 = x;
+    return 0;
+}
+
+// Each sample is predicted from the one decoded just before it, so the
+// decoder runs one sample at a time, still with the two states
+// alternating. The edges of the rows and the first row of the block go
+// through ans_context_decode_at; the rest reads its neighbours directly.
+// The row stores could alias anything, so what the loop uses is copied to
+// locals first.
+static void ans_context_decode_task(void* ctx, int i) {
+    AnsBlockJob* job = (AnsBlockJob*)ctx;
+    size_t first = (size_t)i * job->blockRows;
+    size_t n = job->rows - first < job->blockRows ? job->rows - first : job->blockRows;
+    const AnsModel* models = job->model;
+    size_t rowBytes = job->rowBytes;
+    size_t step = job->step;
+    const unsigned char *p, *end;
+    uint32_t x0, x1;
+    if (ans_block_start(job, i, &p, &end, &x0, &x1) != 0) return;
+
+    int failed = 0;
+    for (size_t y = first; y < first + n && !failed; y++) {
+        unsigned char* row = job->out + y * job->stride;
+        const unsigned char* up = y > first ? row - job->stride : NULL;
+        size_t edge = !up || step > rowBytes ? rowBytes : step;
+        size_t inside = up && rowBytes > step ? rowBytes - step : 0;
+        size_t c = 0;
+        for (; (c < edge || (c & 1)) && c < rowBytes && !failed; c++) {
+            failed = ans_context_decode_at(job, row, up, c, &x0, &x1, &p, end);
+        }
+        uint32_t s0 = x0, s1 = x1;
+        const unsigned char* q = p;
+        for (; c + 2 <= inside && end - q >= 4; c += 2) {
+            int k0 = ans_context(up[c - step], up[c], up[c + step]);
+            int k1 = ans_context(up[c + 1 - step], up[c + 1], up[c + 1 + step]);
+            row[c] = (unsigned char)(ans_decode_symbol(&s0, models + k0) +
+                                     ans_predict(row[c - step], up[c], up[c - step]));
+            row[c + 1] = (unsigned char)(ans_decode_symbol(&s1, models + k1) +
+                                         ans_predict(row[c + 1 - step], up[c + 1], up[c + 1 - step]));
+            ans_renormalize(&s0, &q);
+            ans_renormalize(&s1, &q);
+        }
+        x0 = s0;
+        x1 = s1;
+        p = q;
+        for (; c < rowBytes && !failed; c++) {
+            failed = ans_context_decode_at(job, row, up, c, &x0, &x1, &p, end);
+        }
+    }
+    job->failed[i] = failed || x0 != ANS_LOW || x1 != ANS_LOW || p != end;
+}
+
+static void ans_job_init(AnsBlockJob* job, const unsigned char* in, unsigned char* out, size_t rowBytes,
+                         size_t stride, size_t rows, size_t step, const AnsModel* model) {
+    memset(job, 0, sizeof(*job));
+    job->in = in;
+    job->out = out;
+    job->rowBytes = rowBytes;
+    job->stride = stride;
+    job->blockRows = ans_block_rows(rowBytes);
+    job->rows = rows;
+    job->step = step;
+    job->model = model;
+}
+
+// Codes the blocks of job in parallel with task and writes them out:
+// rows per block, block count, count + 1 byte offsets, then the blocks.
+static int ans_blocks_write(AnsBlockJob* job, ParallelTask task, FILE* file) {
+    uint32_t blockRows = (uint32_t)job->blockRows;
+    uint32_t count = (uint32_t)((job->rows + blockRows - 1) / blockRows);
+    job->blocks = calloc(count + 1, sizeof(unsigned char*));
+    job->starts = calloc(count + 1, sizeof(unsigned char*));
+    job->sizes = calloc(count + 1, sizeof(size_t));
+    job->failed = calloc(count + 1, sizeof(int));
+    uint64_t* offsets = malloc((count + 1) * sizeof(uint64_t));
+
+    int failed = !job->blocks || !job->starts || !job->sizes || !job->failed || !offsets;
+    if (!failed) {
+        parallel_for((int)count, task, job);
+        offsets[0] = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            failed |= job->failed[i];
+            offsets[i + 1] = offsets[i] + job->sizes[i];
+        }
+    }
+    if (!failed) {
+        failed = fwrite(&blockRows, sizeof(blockRows), 1, file) != 1 ||
+                 fwrite(&count, sizeof(count), 1, file) != 1 ||
+                 fwrite(offsets, sizeof(uint64_t), count + 1, file) != count + 1;
+        for (uint32_t i = 0; i < count && !failed; i++) {
+            failed = fwrite(job->starts[i], 1, job->sizes[i], file) != job->sizes[i];
+        }
+    }
+
+    for (uint32_t i = 0; job->blocks && i < count; i++) {
+        free(job->blocks[i]);
+    }
+    free(job->blocks);
+    free(job->starts);
+    free(job->sizes);
+    free(job->failed);
+    free(offsets);
+    return failed ? -1 : 0;
+}
+
+// Checks the block table at the start of in and decodes the blocks in
+// parallel with task.
+static int ans_blocks_read(AnsBlockJob* job, ParallelTask task, const unsigned char* in, size_t size) {
+    uint32_t blockRows, count;
+    if (size < 2 * sizeof(uint32_t)) return -1;
+    memcpy(&blockRows, in, sizeof(uint32_t));
+    memcpy(&count, in + sizeof(uint32_t), sizeof(uint32_t));
+    if (blockRows == 0 || count != (job->rows + blockRows - 1) / blockRows) return -1;
+
+    size_t table = 2 * sizeof(uint32_t) + ((size_t)count + 1) * sizeof(uint64_t);
+    if (size < table) return -1;
+    uint64_t* offsets = malloc(((size_t)count + 1) * sizeof(uint64_t));
+    int* failed = calloc((size_t)count + 1, sizeof(int));
+    int result = -1;
+    if (offsets && failed) {
+        memcpy(offsets, in + 2 * sizeof(uint32_t), ((size_t)count + 1) * sizeof(uint64_t));
+        int valid = offsets[0] == 0;
+        for (uint32_t i = 0; valid && i < count; i++) {
+            valid = offsets[i + 1] >= offsets[i];
+        }
+        if (valid && offsets[count] <= size - table) {
+            job->in = in + table;
+            job->blockRows = blockRows;
+            job->offsets = offsets;
+            job->failed = failed;
+            parallel_for((int)count, task, job);
+            result = 0;
+            for (uint32_t i = 0; i < count; i++) {
+                if (failed[i]) result = -1;
+            }
+        }
+    }
+    free(offsets);
+    free(failed);
+    return result;
+}
+
+// Encodes rows x rowBytes bytes of data, rows stride bytes apart, as rANS
+// blocks in the same layout as the Huffman blocks, coded in parallel. The
+// output is the same for any number of threads. Returns 0, or -1 if
+// memory ran out or the file could not be written.
+int ans_blocks_encode(const unsigned char* data, size_t rowBytes, size_t stride, size_t rows,
+                      const AnsModel* model, FILE* file) {
+    AnsBlockJob job;
+    ans_job_init(&job, data, NULL, rowBytes, stride, rows, 0, model);
+    return ans_blocks_write(&job, ans_block_encode_task, file);
+}
+
+// Decodes rANS blocks held in memory into rows x rowBytes bytes of out,
+// rows stride bytes apart. Returns 0, or -1 on a corrupt stream or when
+// memory ran out.
+int ans_blocks_decode(const unsigned char* in, size_t size, const AnsModel* model,
+                      unsigned char* out, size_t rowBytes, size_t stride, size_t rows) {
+    AnsBlockJob job;
+    ans_job_init(&job, NULL, out, rowBytes, stride, rows, 0, model);
+    return ans_blocks_read(&job, ans_block_decode_task, in, size);
+}
+
+// Context coding. Each sample is predicted from its neighbours and the
+// prediction error is coded, mod 256, with one of ANS_CONTEXTS models
+// chosen by how busy the row above it is: flat areas get a model
+// sharply peaked at zero, edges and texture a wide one. The models are
+// built from the image in a first pass. Samples of one channel are step
+// bytes apart: 1 for grey levels, 3 for 24-bit colour.
+
+// Builds the ANS_CONTEXTS models for rows x rowBytes bytes of data, rows
+// stride bytes apart. A context that never occurs gets a placeholder
+// model. Returns -1 if memory ran out or there is no data.
+int ans_context_models(AnsModel* models, const unsigned char* data, size_t rowBytes, size_t stride,
+                       size_t rows, size_t step) {
+    AnsBlockJob job;
+    ans_job_init(&job, data, NULL, rowBytes, stride, rows, step, NULL);
+    size_t count = (rows + job.blockRows - 1) / job.blockRows;
+    if (count == 0 || rowBytes == 0) return -1;
+    job.counts = malloc(count * sizeof(*job.counts));
+    if (!job.counts) return -1;
+    parallel_for((int)count, ans_context_count_task, &job);
+    for (size_t i = 1; i < count; i++) {
+        for (int k = 0; k < ANS_CONTEXTS; k++) {
+            for (int s = 0; s < 256; s++) {
+                job.counts[0][k][s] += job.counts[i][k][s];
+            }
+        }
+    }
+    int result = 0;
+    for (int k = 0; k < ANS_CONTEXTS && result == 0; k++) {
+        unsigned int* counts = job.counts[0][k];
+        int used = 0;
+        for (int s = 0; s < 256; s++) {
+            used |= counts[s] != 0;
+        }
+        if (!used) counts[0] = 1;
+        result = ans_model_build(&models[k], counts);
+    }
+    free(job.counts);
+    return result;
+}
+
+int ans_write_context_models(FILE* file, const AnsModel* models) {
+    for (int k = 0; k < ANS_CONTEXTS; k++) {
+        if (ans_write_model(file, &models[k]) != 0) return -1;
+    }
+    return 0;
+}
+
+int ans_read_context_models(FILE* file, AnsModel* models) {
+    for (int k = 0; k < ANS_CONTEXTS; k++) {
+        if (ans_read_model(file, &models[k]) != 0) return -1;
+    }
+    return 0;
+}
+
+// As ans_blocks_encode, coding prediction errors with the context models.
+int ans_context_blocks_encode(const unsigned char* data, size_t rowBytes, size_t stride, size_t rows,
+                              size_t step, const AnsModel* models, FILE* file) {
+    AnsBlockJob job;
+    ans_job_init(&job, data, NULL, rowBytes, stride, rows, step, models);
+    return ans_blocks_write(&job, ans_context_encode_task, file);
+}
+
+int ans_context_blocks_decode(const unsigned char* in, size_t size, const AnsModel* models, size_t step,
+                              unsigned char* out, size_t rowBytes, size_t stride, size_t rows) {
+    AnsBlockJob job;
+    ans_job_init(&job, NULL, out, rowBytes, stride, rows, step, models);
+    return ans_blocks_read(&job, ans_context_decode_task, in, size);
+}
+
+#endif
@@ -0,0 +1,278 @@
+#ifndef BITIO_H
+#define BITIO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pipeline.h"
+
+#define BIT_READER_CHUNK (1 << 16)
+
+// MSB-first bit reader over an in-memory buffer. The unread bits are kept
+// left aligned in a 64-bit accumulator; after a refill at least 57 bits are
+// available, so several codes can be peeked without touching the buffer.
+// A reader opened on a stream reads it a chunk at a time as the bits are
+// used up, so decoding starts as soon as the first chunk has arrived.
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    size_t pos;
+    uint64_t acc;
+    int count;
+    FILE* file;           // where the next chunk comes from, NULL at the end
+    unsigned char* chunk; // data, when reading from a stream
+} BitReader;
+
+static inline void bit_reader_init(BitReader* br, const unsigned char* data, size_t size) {
+    br->data = data;
+    br->size = size;
+    br->pos = 0;
+    br->acc = 0;
+    br->count = 0;
+    br->file = NULL;
+    br->chunk = NULL;
+}
+
+// Reads the rest of file a chunk at a time. Returns -1 if out of memory.
+int bit_reader_open(BitReader* br, FILE* file) {
+    bit_reader_init(br, NULL, 0);
+    br->chunk = malloc(BIT_READER_CHUNK);
+    if (!br->chunk) return -1;
+    br->data = br->chunk;
+    br->file = file;
+    return 0;
+}
+
+void bit_reader_close(BitReader* br) {
+    free(br->chunk);
+    br->chunk = NULL;
+}
+
+// Moves the unread bytes to the front of the chunk and reads more behind
+// them, until there are 8 or the stream ends.
+static void bit_reader_load(BitReader* br) {
+    size_t left = br->pos < br->size ? br->size - br->pos : 0;
+    memmove(br->chunk, br->chunk + br->pos, left);
+    br->pos = 0;
+    br->size = left;
+    while (br->file && br->size < 8) {
+        size_t got = fread(br->chunk + br->size, 1, BIT_READER_CHUNK - br->size, br->file);
+        br->size += got;
+        if (got == 0) br->file = NULL;
+    }
+}
+
+static inline void bit_reader_refill(BitReader* br) {
+    if (br->count > 56) return;
+    if (br->pos + 8 > br->size && br->file) bit_reader_load(br);
+    if (br->pos + 8 <= br->size) {
+        const unsigned char* p = br->data + br->pos;
+        uint64_t v = ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+                     ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+                     ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+                     ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+        int bytes = (63 - br->count) >> 3;
+        br->acc |= v >> br->count;
+        br->pos += bytes;
+        br->count += bytes * 8;
+        return;
+    }
+    // Past the end of the buffer the reader is fed zero bytes; callers check
+    // bit_reader_overrun() once they are done instead of on every refill.
+    while (br->count <= 56) {
+        uint64_t byte = br->pos < br->size ? br->data[br->pos] : 0;
+        br->acc |= byte << (56 - br->count);
+        br->pos++;
+        br->count += 8;
+    }
+}
+
+// Tops the accumulator up to at least 56 bits with no branches. Only for
+// when there are 8 bytes left to read in the buffer.
+static inline void bit_reader_refill_fast(BitReader* br) {
+    const unsigned char* p = br->data + br->pos;
+    uint64_t v = ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+                 ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+                 ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+                 ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+    int bytes = (63 - br->count) >> 3;
+    br->acc |= v >> br->count;
+    br->pos += bytes;
+    br->count += bytes * 8;
+}
+
+// n must be between 1 and the number of buffered bits.
+static inline unsigned int bit_reader_peek(const BitReader* br, int n) {
+    return (unsigned int)(br->acc >> (64 - n));
+}
+
+static inline void bit_reader_skip(BitReader* br, int n) {
+    br->acc <<= n;
+    br->count -= n;
+}
+
+static inline int bit_reader_overrun(const BitReader* br) {
+    return br->pos * 8 - br->count > br->size * 8;
+}
+
+#define BIT_WRITER_BUFFER (1 << 20)
+
+// MSB-first bit writer. Codes are packed into a left aligned 64-bit
+// accumulator, whole bytes are stored into a large buffer eight at a time
+// and the buffer only reaches stdio when it is full. Full buffers go to a
+// writer thread, so encoding carries on into the next buffer while the
+// last one is being written; if the thread cannot be started they are
+// written in place. Without a file the buffer grows instead and keeps the
+// whole output in memory.
+typedef struct {
+    FILE* file;
+    PipeWriter* pipe;  // the writer thread, NULL if writes happen in place
+    unsigned char* buffer;
+    size_t pos;
+    size_t cap;
+    uint64_t acc;
+    int count;
+    int error;
+} BitWriter;
+
+int bit_writer_init(BitWriter* bw, FILE* file) {
+    bw->file = file;
+    bw->pipe = file ? (PipeWriter*)malloc(sizeof(PipeWriter)) : NULL;
+    if (bw->pipe && pipe_writer_start(bw->pipe, file, BIT_WRITER_BUFFER) != 0) {
+        free(bw->pipe);
+        bw->pipe = NULL;
+    }
+    bw->buffer = bw->pipe ? pipe_queue_reserve(&bw->pipe->queue) : malloc(BIT_WRITER_BUFFER);
+    bw->pos = 0;
+    bw->cap = BIT_WRITER_BUFFER;
+    bw->acc = 0;
+    bw->count = 0;
+    bw->error = bw->buffer == NULL;
+    return bw->error ? -1 : 0;
+}
+
+static inline void bit_writer_flush_buffer(BitWriter* bw) {
+    if (!bw->file) {
+        unsigned char* grown = realloc(bw->buffer, bw->cap * 2);
+        if (grown) {
+            bw->buffer = grown;
+            bw->cap *= 2;
+        } else {
+            bw->error = 1;
+            bw->pos = 0;
+        }
+        return;
+    }
+    if (bw->pipe) {
+        if (bw->pos) {
+            pipe_queue_publish(&bw->pipe->queue, (long)bw->pos);
+            bw->buffer = pipe_queue_reserve(&bw->pipe->queue);
+        }
+        bw->pos = 0;
+        return;
+    }
+    if (bw->pos && fwrite(bw->buffer, 1, bw->pos, bw->file) != bw->pos) bw->error = 1;
+    bw->pos = 0;
+}
+
+// Moves the whole bytes of the accumulator into the buffer.
+static inline void bit_writer_drain(BitWriter* bw) {
+    int bytes = bw->count >> 3;
+    if (bw->pos + 8 > bw->cap) bit_writer_flush_buffer(bw);
+    unsigned char* p = bw->buffer + bw->pos;
+    uint64_t v = bw->acc;
+    p[0] = (unsigned char)(v >> 56);
+    p[1] = (unsigned char)(v >> 48);
+    p[2] = (unsigned char)(v >> 40);
+    p[3] = (unsigned char)(v >> 32);
+    p[4] = (unsigned char)(v >> 24);
+    p[5] = (unsigned char)(v >> 16);
+    p[6] = (unsigned char)(v >> 8);
+    p[7] = (unsigned char)v;
+    bw->pos += bytes;
+    bw->acc = bytes == 8 ? 0 : bw->acc << (bytes * 8);
+    bw->count -= bytes * 8;
+}
+
+// Appends the low `length` bits of code, most significant bit first.
+static inline void bit_writer_put(BitWriter* bw, uint64_t code, int length) {
+    if (length > 56) {
+        bit_writer_put(bw, code >> 32, length - 32);
+        code &= 0xFFFFFFFFu;
+        length = 32;
+    }
+    if (length == 0) return;
+    if (bw->count + length > 64) bit_writer_drain(bw);
+    bw->acc |= code << (64 - bw->count - length);
+    bw->count += length;
+}
+
+// Appends n whole bytes. Must be called at a byte boundary.
+void bit_writer_bytes(BitWriter* bw, const void* data, size_t n) {
+    const unsigned char* p = (const unsigned char*)data;
+    bit_writer_drain(bw);
+    while (n > 0) {
+        if (bw->pos == bw->cap) bit_writer_flush_buffer(bw);
+        size_t chunk = bw->cap - bw->pos < n ? bw->cap - bw->pos : n;
+        memcpy(bw->buffer + bw->pos, p, chunk);
+        bw->pos += chunk;
+        p += chunk;
+        n -= chunk;
+    }
+}
+
+// Pads the last byte with zero bits and writes out everything buffered,
+// waiting for the writer thread, so the file is up to date on return.
+// A writer without a file keeps the bytes in buffer[0, pos) instead.
+int bit_writer_flush(BitWriter* bw) {
+    bit_writer_drain(bw);
+    if (bw->count > 0) {
+        bw->count = 8;
+        bit_writer_drain(bw);
+    }
+    if (bw->file) bit_writer_flush_buffer(bw);
+    if (bw->pipe) {
+        pipe_queue_drain(&bw->pipe->queue);
+        if (bw->pipe->error) bw->error = 1;
+    }
+    return bw->error ? -1 : 0;
+}
+
+// Stops the writer thread once it has written what was flushed.
+void bit_writer_free(BitWriter* bw) {
+    if (bw->pipe) {
+        pipe_writer_finish(bw->pipe);
+        free(bw->pipe);
+        bw->pipe = NULL;
+    } else {
+        free(bw->buffer);
+    }
+    bw->buffer = NULL;
+}
+
+// Reads everything left in the stream into a heap buffer. Works on pipes as
+// well as regular files since it never seeks.
+unsigned char* read_remaining(FILE* file, size_t* size) {
+    size_t cap = 1 << 16;
+    size_t len = 0;
+    unsigned char* buf = malloc(cap);
+    if (!buf) return NULL;
+    size_t got;
+    while ((got = fread(buf + len, 1, cap - len, file)) > 0) {
+        len += got;
+        if (len == cap) {
+            unsigned char* grown = realloc(buf, cap * 2);
+            if (!grown) {
+                free(buf);
+                return NULL;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+    }
+    *size = len;
+    return buf;
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef BMPSINK_H
+#define BMPSINK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+#include "mapfile.h"
+
+// Uncompressed BMP output. Its size is known from the headers, so the file
+// is preallocated and mapped with the headers already written, and the
+// decoders put the pixel rows straight into it, stride bytes apart. The
+// mapping starts out zeroed, so the padding needs no writes. A decoder
+// that can only produce packed rows writes a run of them packed at the
+// place of its first row and bmp_sink_spread_rows moves them out to their
+// places in the same memory. Rows are asked for in order, so output that
+// cannot be mapped is written out a window of rows at a time.
+typedef struct {
+    MappedSink sink;
+    const char* path;
+    size_t offset; // of the first row in the file
+    size_t row_bytes;
+    size_t stride;
+    size_t rows;
+} BmpSink;
+
+int bmp_sink_open(BmpSink* dst, const char* path, const BmpFile* file, const BmpInfo* info) {
+    dst->path = path;
+    dst->row_bytes = bmp_row_bytes(info);
+    dst->stride = bmp_stride(info);
+    dst->rows = bmp_rows(info);
+    if (map_sink_open(&dst->sink, path, file->Offbits + dst->stride * dst->rows) != 0) {
+        printf("Error: Cannot create output file %s\n", path);
+        return -1;
+    }
+    // Asking for the headers and the first row up front makes the window
+    // big enough for any single row later on
+    dst->offset = file->Offbits;
+    unsigned char* head = map_sink_reserve(&dst->sink, 0, dst->offset + dst->stride);
+    if (!head) {
+        printf("Error: Memory allocation failed\n");
+        map_sink_abort(&dst->sink);
+        return -1;
+    }
+    memcpy(head, file, sizeof(BmpFile));
+    memcpy(head + sizeof(BmpFile), info, sizeof(BmpInfo));
+    return 0;
+}
+
+// Rows first .. first + count - 1, or NULL if there is no memory for them.
+// Asking for them says the rows before first are done.
+static inline unsigned char* bmp_sink_rows(BmpSink* dst, size_t first, size_t count) {
+    return map_sink_reserve(&dst->sink, dst->offset + first * dst->stride, count * dst->stride);
+}
+
+// A single row always fits.
+static inline unsigned char* bmp_sink_row(BmpSink* dst, size_t y) {
+    return bmp_sink_rows(dst, y, 1);
+}
+
+// Rows first .. first + count - 1 were written packed, row_bytes apart,
+// from bmp_sink_rows(dst, first, count): moves them out to stride apart.
+// Going from the last row down, no row is overwritten before it has been
+// moved.
+void bmp_sink_spread_rows(BmpSink* dst, size_t first, size_t count) {
+    unsigned char* base = bmp_sink_rows(dst, first, count);
+    if (dst->stride == dst->row_bytes) return;
+    for (size_t i = count; i-- > 0;) {
+        memmove(base + i * dst->stride, base + i * dst->row_bytes, dst->row_bytes);
+        memset(base + i * dst->stride + dst->row_bytes, 0, dst->stride - dst->row_bytes);
+    }
+}
+
+int bmp_sink_close(BmpSink* dst) {
+    if (map_sink_close(&dst->sink) != 0) {
+        printf("Error: Failed to write output file %s\n", dst->path);
+        return -1;
+    }
+    return 0;
+}
+
+// Drops the output of a decode that failed.
+void bmp_sink_discard(BmpSink* dst) {
+    map_sink_abort(&dst->sink);
+    if (!is_std_stream(dst->path)) remove(dst->path);
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef BMPSOURCE_H
+#define BMPSOURCE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+#include "mapfile.h"
+
+// Uncompressed BMP input read through a memory map. The headers are copied
+// out and codecs are handed the pixel rows in place: a row is row_bytes of
+// pixels and rows start stride bytes apart, so the padding is stepped over
+// instead of copied out. Rows come in the order they are stored, bottom-up
+// for a positive height and top-down for a negative one, which is also the
+// order the decoders write them back in. Sizes are 64-bit throughout.
+typedef struct {
+    MappedFile map;
+    BmpFile file;
+    BmpInfo info;
+    const unsigned char* pixels; // first row as stored in the file
+    size_t row_bytes;            // pixel bytes in a row
+    size_t stride;               // row_bytes plus the padding to 4 bytes
+    size_t rows;
+} BmpSource;
+
+int bmp_source_open(BmpSource* src, const char* path) {
+    if (map_file_open(&src->map, path) != 0) {
+        printf("Error: Cannot open input file %s\n", path);
+        return -1;
+    }
+    if (src->map.size < sizeof(BmpFile) + sizeof(BmpInfo)) {
+        printf("Error: Failed to read BMP headers\n");
+        unmap_file(&src->map);
+        return -1;
+    }
+    memcpy(&src->file, src->map.data, sizeof(BmpFile));
+    memcpy(&src->info, src->map.data + sizeof(BmpFile), sizeof(BmpInfo));
+    if (src->info.Width <= 0 || src->info.Height == 0 || src->info.BitCount < 8) {
+        printf("Error: Unsupported BMP: %dx%d, %d bpp\n", src->info.Width, src->info.Height, src->info.BitCount);
+        unmap_file(&src->map);
+        return -1;
+    }
+
+    src->row_bytes = bmp_row_bytes(&src->info);
+    src->stride = bmp_stride(&src->info);
+    src->rows = bmp_rows(&src->info);
+    if (src->file.Offbits > src->map.size ||
+        (src->map.size - src->file.Offbits) / src->stride < src->rows) {
+        printf("Error: Pixel data is truncated\n");
+        unmap_file(&src->map);
+        return -1;
+    }
+    src->pixels = src->map.data + src->file.Offbits;
+    return 0;
+}
+
+// Row y in the order it is stored in the file.
+static inline const unsigned char* bmp_source_row(const BmpSource* src, size_t y) {
+    return src->pixels + y * src->stride;
+}
+
+// Pixel bytes in the image, without padding.
+static inline size_t bmp_source_size(const BmpSource* src) {
+    return src->row_bytes * src->rows;
+}
+
+void bmp_source_close(BmpSource* src) {
+    unmap_file(&src->map);
+}
+
+#endif
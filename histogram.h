@@ -0,0 +1,106 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parallel.h"
+
+#define HISTOGRAM_WAYS 4               // interleaved sub-histograms, 1 to 8
+#define HISTOGRAM_TASK_BYTES (1 << 18) // bytes counted per thread task
+
+// Adds rows x rowBytes bytes of data, rows stride bytes apart, to the
+// sub-histograms sub. Runs of the same byte would make each increment wait
+// for the one before it to be stored, so neighbouring bytes are counted in
+// separate sub-histograms, summed by histogram_fold once all the rows are
+// in. The bytes are read eight at a time, byte k going to sub-histogram
+// k % HISTOGRAM_WAYS.
+static void histogram_add_rows(unsigned int (*sub)[256], const unsigned char* data,
+                               size_t rowBytes, size_t stride, size_t rows) {
+    if (stride == rowBytes) {
+        rowBytes *= rows;
+        rows = rows ? 1 : 0;
+    }
+    for (size_t y = 0; y < rows; y++, data += stride) {
+        size_t i = 0;
+        for (; i + 8 <= rowBytes; i += 8) {
+            uint64_t v;
+            memcpy(&v, data + i, 8);
+            sub[0 % HISTOGRAM_WAYS][v & 0xFF]++;
+            sub[1 % HISTOGRAM_WAYS][(v >> 8) & 0xFF]++;
+            sub[2 % HISTOGRAM_WAYS][(v >> 16) & 0xFF]++;
+            sub[3 % HISTOGRAM_WAYS][(v >> 24) & 0xFF]++;
+            sub[4 % HISTOGRAM_WAYS][(v >> 32) & 0xFF]++;
+            sub[5 % HISTOGRAM_WAYS][(v >> 40) & 0xFF]++;
+            sub[6 % HISTOGRAM_WAYS][(v >> 48) & 0xFF]++;
+            sub[7 % HISTOGRAM_WAYS][v >> 56]++;
+        }
+        for (; i < rowBytes; i++) {
+            sub[0][data[i]]++;
+        }
+    }
+}
+
+static void histogram_fold(unsigned int* hist, unsigned int (*sub)[256]) {
+    for (int s = 0; s < 256; s++) {
+        for (int w = 0; w < HISTOGRAM_WAYS; w++) {
+            hist[s] += sub[w][s];
+        }
+    }
+}
+
+// Adds the n bytes of data to hist.
+void histogram_count(unsigned int* hist, const unsigned char* data, size_t n) {
+    unsigned int sub[HISTOGRAM_WAYS][256];
+    memset(sub, 0, sizeof(sub));
+    histogram_add_rows(sub, data, n, n, 1);
+    histogram_fold(hist, sub);
+}
+
+typedef struct {
+    const unsigned char* data;
+    size_t rowBytes;
+    size_t stride;
+    size_t rows;
+    size_t taskRows;
+    unsigned int (*partial)[HISTOGRAM_WAYS][256]; // sub-histograms per task
+} HistogramJob;
+
+static void histogram_task(void* ctx, int i) {
+    HistogramJob* job = (HistogramJob*)ctx;
+    size_t first = (size_t)i * job->taskRows;
+    size_t n = job->rows - first < job->taskRows ? job->rows - first : job->taskRows;
+    memset(job->partial[i], 0, sizeof(job->partial[i]));
+    histogram_add_rows(job->partial[i], job->data + first * job->stride, job->rowBytes, job->stride, n);
+}
+
+// Adds rows x rowBytes bytes of data, rows stride bytes apart, to hist.
+// Large inputs are split into runs of rows counted on the thread pool, and
+// the sub-histograms of each run are added up afterwards.
+void histogram_count_rows(unsigned int* hist, const unsigned char* data,
+                          size_t rowBytes, size_t stride, size_t rows) {
+    HistogramJob job;
+    job.data = data;
+    job.rowBytes = rowBytes;
+    job.stride = stride;
+    job.rows = rows;
+    job.taskRows = rowBytes ? HISTOGRAM_TASK_BYTES / rowBytes : rows;
+    if (job.taskRows == 0) job.taskRows = 1;
+    size_t tasks = rows ? (rows + job.taskRows - 1) / job.taskRows : 0;
+    job.partial = tasks > 1 && parallel_threads() > 1 ? malloc(tasks * sizeof(*job.partial)) : NULL;
+
+    if (!job.partial) {
+        unsigned int sub[HISTOGRAM_WAYS][256];
+        memset(sub, 0, sizeof(sub));
+        histogram_add_rows(sub, data, rowBytes, stride, rows);
+        histogram_fold(hist, sub);
+        return;
+    }
+    parallel_for((int)tasks, histogram_task, &job);
+    for (size_t i = 0; i < tasks; i++) {
+        histogram_fold(hist, job.partial[i]);
+    }
+    free(job.partial);
+}
+
+#endif
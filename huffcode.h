@@ -0,0 +1,869 @@
+#ifndef HUFFCODE_H
+#define HUFFCODE_H
+
+#include <stdint.h>
+#include <string.h>
+#include "bitio.h"
+#include "histogram.h"
+#include "parallel.h"
+
+#define MAX_TREE_NODES 511 // 256 leaf nodes + 255 internal nodes
+#define HUFF_TABLE_BITS 11
+#define HUFF_NO_ENTRY 0xFFFF
+#define HUFF_MAX_STORED_LENGTH 63
+#define HUFF_MIN_LIMIT 11 // range of code length caps offered for canonical codes
+#define HUFF_MAX_LIMIT 15
+
+// Table layouts that can follow the fixed header of a Huffman stream.
+// The header is followed by HUFF_MAGIC, a version byte and the mode byte.
+// Streams without the marker predate it and hold a HUFF_MODE_FREQ table:
+// the PGM one starts with a nonzero symbol, the BMP one with the size word.
+#define HUFF_MAGIC "\0\0HF"
+#define HUFF_MAGIC_BYTES 4
+#define HUFF_VERSION 1
+#define HUFF_MODE_FREQ 0      // symbol frequencies, tree rebuilt on decode
+#define HUFF_MODE_CANONICAL 1 // packed code lengths, canonical codes
+#define HUFF_MODE_BLOCKS 2    // packed code lengths, independent blocks of rows
+#define HUFF_MODE_STREAMS 3   // as HUFF_MODE_BLOCKS, four bitstreams a block
+#define HUFF_MODE_ADAPTIVE 4  // code length cap, codes rebuilt as the data goes
+#define HUFF_MODE_ANS 5       // quantized frequencies, rANS-coded blocks (ans.h)
+#define HUFF_MODE_CONTEXT 6   // prediction errors, rANS models chosen by context
+
+#define HUFF_BLOCK_BYTES (1 << 18) // input bytes per block in the block layout
+#define HUFF_STREAMS 4             // interleaved bitstreams in a HUFF_MODE_STREAMS block
+#define HUFF_ADAPT_FIRST (1 << 10)   // symbols before the first code rebuild in HUFF_MODE_ADAPTIVE
+#define HUFF_ADAPT_SYMBOLS (1 << 16) // most symbols between two rebuilds
+
+// Table-driven Huffman decoder shared by the PGM and BMP codecs.
+// Codes up to HUFF_TABLE_BITS long are resolved with a single probe of
+// the primary table. Longer codes land on an entry with length 0 whose
+// value is a node of the index tree, and the rest of the code is walked
+// from there one bit at a time.
+typedef struct {
+    unsigned short value;  // symbol, or tree node when length is 0
+    unsigned char length;  // bits consumed by this entry
+} HuffEntry;
+
+typedef struct {
+    HuffEntry table[1 << HUFF_TABLE_BITS];
+    short child[MAX_TREE_NODES][2]; // 0 = empty, < 0 = leaf (-1 - symbol)
+    int nodes;
+    int symbols;
+    int single; // set when the alphabet has a single, zero-length code
+} HuffDecoder;
+
+void huff_decoder_init(HuffDecoder* d) {
+    memset(d->child, 0, sizeof(d->child));
+    d->nodes = 1;
+    d->symbols = 0;
+    d->single = -1;
+}
+
+// Adds one code (right aligned in `code`) to the decoder. Returns -1 when
+// the code clashes with one added earlier.
+int huff_decoder_add(HuffDecoder* d, uint64_t code, int length, unsigned char symbol) {
+    d->symbols++;
+    if (length == 0) {
+        if (d->symbols != 1) return -1;
+        d->single = symbol;
+        return 0;
+    }
+    if (length > 64 || d->single >= 0) return -1;
+
+    int node = 0;
+    for (int i = length - 1; i > 0; i--) {
+        int bit = (code >> i) & 1;
+        int next = d->child[node][bit];
+        if (next < 0) return -1;
+        if (next == 0) {
+            if (d->nodes >= MAX_TREE_NODES) return -1;
+            next = d->nodes++;
+            d->child[node][bit] = (short)next;
+        }
+        node = next;
+    }
+    int bit = code & 1;
+    if (d->child[node][bit] != 0) return -1;
+    d->child[node][bit] = (short)(-1 - symbol);
+    return 0;
+}
+
+// Fills the primary table from the index tree. Call once after all codes
+// have been added.
+void huff_decoder_finish(HuffDecoder* d) {
+    for (int idx = 0; idx < (1 << HUFF_TABLE_BITS); idx++) {
+        HuffEntry e = { HUFF_NO_ENTRY, 0 };
+        int node = 0;
+        for (int b = 0; b < HUFF_TABLE_BITS; b++) {
+            int next = d->child[node][(idx >> (HUFF_TABLE_BITS - 1 - b)) & 1];
+            if (next == 0) break;
+            if (next < 0) {
+                e.value = (unsigned short)(-1 - next);
+                e.length = (unsigned char)(b + 1);
+                break;
+            }
+            node = next;
+            if (b == HUFF_TABLE_BITS - 1) e.value = (unsigned short)node;
+        }
+        d->table[idx] = e;
+    }
+}
+
+// Returns the next symbol, or -1 on a bit pattern that is not a code.
+static inline int huff_decode(const HuffDecoder* d, BitReader* br) {
+    if (br->count < HUFF_TABLE_BITS) bit_reader_refill(br);
+    HuffEntry e = d->table[bit_reader_peek(br, HUFF_TABLE_BITS)];
+    if (e.length) {
+        bit_reader_skip(br, e.length);
+        return e.value;
+    }
+    if (e.value == HUFF_NO_ENTRY) return -1;
+
+    bit_reader_skip(br, HUFF_TABLE_BITS);
+    int node = e.value;
+    while (node > 0) {
+        if (br->count == 0) bit_reader_refill(br);
+        int bit = bit_reader_peek(br, 1);
+        bit_reader_skip(br, 1);
+        node = d->child[node][bit];
+    }
+    return node < 0 ? -1 - node : -1;
+}
+
+// Decodes up to n symbols into out and returns how many were produced.
+// Stops early on an invalid code; running off the end of the input is
+// reported by bit_reader_overrun().
+size_t huff_decode_run(const HuffDecoder* d, BitReader* br, unsigned char* out, size_t n) {
+    if (d->single >= 0) {
+        memset(out, d->single, n);
+        return n;
+    }
+    size_t i = 0;
+    for (; i < n; i++) {
+        int symbol = huff_decode(d, br);
+        if (symbol < 0) break;
+        out[i] = (unsigned char)symbol;
+    }
+    return i;
+}
+
+// Decodes up to n symbols into out, symbol x from stream x % HUFF_STREAMS,
+// and returns how many were produced. The streams do not depend on one
+// another, so the four decodes of each round overlap in the CPU instead of
+// each waiting for the bit position left by the one before.
+size_t huff_decode_streams(const HuffDecoder* d, BitReader* br, unsigned char* out, size_t n) {
+    if (d->single >= 0) {
+        memset(out, d->single, n);
+        return n;
+    }
+    // Local copies, so the readers stay in registers across the stores to out
+    BitReader r[HUFF_STREAMS] = { br[0], br[1], br[2], br[3] };
+    size_t x = 0;
+    // While every stream has 8 bytes left, each round tops all four up to 56
+    // bits without a branch, which covers two table hits from each
+    while (x + 2 * HUFF_STREAMS <= n && r[0].pos + 8 <= r[0].size && r[1].pos + 8 <= r[1].size &&
+           r[2].pos + 8 <= r[2].size && r[3].pos + 8 <= r[3].size) {
+        bit_reader_refill_fast(&r[0]);
+        bit_reader_refill_fast(&r[1]);
+        bit_reader_refill_fast(&r[2]);
+        bit_reader_refill_fast(&r[3]);
+        int s0 = huff_decode(d, &r[0]);
+        int s1 = huff_decode(d, &r[1]);
+        int s2 = huff_decode(d, &r[2]);
+        int s3 = huff_decode(d, &r[3]);
+        int s4 = huff_decode(d, &r[0]);
+        int s5 = huff_decode(d, &r[1]);
+        int s6 = huff_decode(d, &r[2]);
+        int s7 = huff_decode(d, &r[3]);
+        if ((s0 | s1 | s2 | s3 | s4 | s5 | s6 | s7) < 0) {
+            n = x; // the streams are out of step now, stop here
+            break;
+        }
+        out[x] = (unsigned char)s0;
+        out[x + 1] = (unsigned char)s1;
+        out[x + 2] = (unsigned char)s2;
+        out[x + 3] = (unsigned char)s3;
+        out[x + 4] = (unsigned char)s4;
+        out[x + 5] = (unsigned char)s5;
+        out[x + 6] = (unsigned char)s6;
+        out[x + 7] = (unsigned char)s7;
+        x += 2 * HUFF_STREAMS;
+    }
+    for (; x + HUFF_STREAMS <= n; x += HUFF_STREAMS) {
+        int s0 = huff_decode(d, &r[0]);
+        int s1 = huff_decode(d, &r[1]);
+        int s2 = huff_decode(d, &r[2]);
+        int s3 = huff_decode(d, &r[3]);
+        if ((s0 | s1 | s2 | s3) < 0) {
+            n = x;
+            break;
+        }
+        out[x] = (unsigned char)s0;
+        out[x + 1] = (unsigned char)s1;
+        out[x + 2] = (unsigned char)s2;
+        out[x + 3] = (unsigned char)s3;
+    }
+    for (; x < n; x++) {
+        int symbol = huff_decode(d, &r[x % HUFF_STREAMS]);
+        if (symbol < 0) break;
+        out[x] = (unsigned char)symbol;
+    }
+    memcpy(br, r, sizeof(r));
+    return x;
+}
+
+// Assigns canonical codes: shorter codes first, equal lengths in symbol
+// order. Returns -1 if the lengths do not describe a prefix code.
+int huff_canonical_codes(const int* lengths, uint64_t* codes) {
+    int count[HUFF_MAX_STORED_LENGTH + 1] = {0};
+    for (int s = 0; s < 256; s++) {
+        if (lengths[s] < 0 || lengths[s] > HUFF_MAX_STORED_LENGTH) return -1;
+        count[lengths[s]]++;
+    }
+    count[0] = 0;
+
+    uint64_t next[HUFF_MAX_STORED_LENGTH + 1];
+    uint64_t code = 0;
+    next[0] = 0;
+    for (int len = 1; len <= HUFF_MAX_STORED_LENGTH; len++) {
+        code = (code + count[len - 1]) << 1;
+        next[len] = code;
+        if (code + count[len] > ((uint64_t)1 << len)) return -1;
+    }
+    for (int s = 0; s < 256; s++) {
+        codes[s] = lengths[s] ? next[lengths[s]]++ : 0;
+    }
+    return 0;
+}
+
+// Huffman tree shared by the PGM and BMP codecs, held in a fixed array of
+// nodes with no heap allocations. The leaves come first, sorted by
+// frequency, and the internal nodes follow in the order they are made, so
+// every node sits before its parent and the root is the last one.
+typedef struct {
+    uint64_t freq[MAX_TREE_NODES];
+    unsigned short child[MAX_TREE_NODES][2]; // internal nodes only
+    unsigned char symbol[MAX_TREE_NODES];    // leaves only
+    int leaves;
+    int root;
+} HuffTree;
+
+// Builds the tree for the symbols with a non-zero frequency, in linear
+// time after the sort: the leaves and the internal nodes each form a queue
+// sorted by frequency, so the two smallest nodes are always at the heads.
+// On a tie the leaf is taken, which keeps the tree shallow. Returns -1 if
+// no symbol is used.
+int huff_tree_build(HuffTree* t, const unsigned int* freq) {
+    int n = 0;
+    for (int s = 0; s < 256; s++) {
+        if (!freq[s]) continue;
+        // Insertion by frequency, then symbol
+        int j = n++;
+        while (j > 0 && t->freq[j - 1] > freq[s]) {
+            t->freq[j] = t->freq[j - 1];
+            t->symbol[j] = t->symbol[j - 1];
+            j--;
+        }
+        t->freq[j] = freq[s];
+        t->symbol[j] = (unsigned char)s;
+    }
+    t->leaves = n;
+    t->root = n - 1;
+    if (n == 0) return -1;
+
+    int leaf = 0, inner = n;
+    for (int node = n; node < 2 * n - 1; node++) {
+        for (int k = 0; k < 2; k++) {
+            int pick = leaf < n && (inner == node || t->freq[leaf] <= t->freq[inner]) ? leaf++ : inner++;
+            t->child[node][k] = (unsigned short)pick;
+        }
+        t->freq[node] = t->freq[t->child[node][0]] + t->freq[t->child[node][1]];
+    }
+    t->root = 2 * n - 2;
+    return 0;
+}
+
+// HUFF_MODE_FREQ stores only the frequencies and the decoder builds the
+// tree again, so that mode has to pair nodes exactly as the original
+// coders did, ties included. The two builders below do that. Their leaves
+// sit in symbol order, and the first node of each pair becomes child 0.
+
+// Moves heap[at] down the min-heap of size nodes. On a tie between the
+// two children the left one is taken.
+static void huff_heap_sift(int* heap, int size, const uint64_t* freq, int at) {
+    for (;;) {
+        int least = at, l = 2 * at + 1, r = 2 * at + 2;
+        if (l < size && freq[heap[l]] < freq[heap[least]]) least = l;
+        if (r < size && freq[heap[r]] < freq[heap[least]]) least = r;
+        if (least == at) return;
+        int swap = heap[at];
+        heap[at] = heap[least];
+        heap[least] = swap;
+        at = least;
+    }
+}
+
+// Pairing of the original PGM coder. It uses a binary min-heap built over
+// the leaves, and each parent goes back into the heap after its children.
+int huff_tree_build_heap(HuffTree* t, const unsigned int* freq) {
+    int heap[256];
+    int size = 0;
+    for (int s = 0; s < 256; s++) {
+        if (!freq[s]) continue;
+        t->freq[size] = freq[s];
+        t->symbol[size] = (unsigned char)s;
+        heap[size] = size;
+        size++;
+    }
+    int n = size;
+    t->leaves = n;
+    t->root = n - 1;
+    if (n == 0) return -1;
+
+    for (int i = (size - 2) / 2; i >= 0; i--) huff_heap_sift(heap, size, t->freq, i);
+    for (int node = n; size > 1; node++) {
+        for (int k = 0; k < 2; k++) {
+            t->child[node][k] = (unsigned short)heap[0];
+            heap[0] = heap[--size];
+            huff_heap_sift(heap, size, t->freq, 0);
+        }
+        t->freq[node] = t->freq[t->child[node][0]] + t->freq[t->child[node][1]];
+        int i = size++;
+        while (i && t->freq[node] < t->freq[heap[(i - 1) / 2]]) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap[i] = node;
+        t->root = node;
+    }
+    return 0;
+}
+
+// Pairing of the original BMP coder. It scans a list of live nodes for
+// the two smallest. The parent takes the place of the smallest one, and
+// the last node in the list fills the place of the other.
+int huff_tree_build_scan(HuffTree* t, const unsigned int* freq) {
+    int live[256];
+    int count = 0;
+    for (int s = 0; s < 256; s++) {
+        if (!freq[s]) continue;
+        t->freq[count] = freq[s];
+        t->symbol[count] = (unsigned char)s;
+        live[count] = count;
+        count++;
+    }
+    int n = count;
+    t->leaves = n;
+    t->root = n - 1;
+    if (n == 0) return -1;
+
+    for (int node = n; count > 1; node++) {
+        int min1 = 0, min2 = 1;
+        if (t->freq[live[min2]] < t->freq[live[min1]]) {
+            min1 = 1;
+            min2 = 0;
+        }
+        for (int i = 2; i < count; i++) {
+            if (t->freq[live[i]] < t->freq[live[min1]]) {
+                min2 = min1;
+                min1 = i;
+            } else if (t->freq[live[i]] < t->freq[live[min2]]) {
+                min2 = i;
+            }
+        }
+        t->child[node][0] = (unsigned short)live[min1];
+        t->child[node][1] = (unsigned short)live[min2];
+        t->freq[node] = t->freq[live[min1]] + t->freq[live[min2]];
+        live[min1] = node;
+        live[min2] = live[count - 1];
+        count--;
+        t->root = node;
+    }
+    return 0;
+}
+
+// Codes and lengths of every symbol, walking down from the root; symbols
+// not in the tree get length 0. A tree of one leaf gives it an empty code.
+void huff_tree_codes(const HuffTree* t, uint64_t* codes, int* lengths) {
+    uint64_t code[MAX_TREE_NODES];
+    int depth[MAX_TREE_NODES];
+    memset(lengths, 0, 256 * sizeof(int));
+    memset(codes, 0, 256 * sizeof(uint64_t));
+    if (t->leaves == 0) return;
+    code[t->root] = 0;
+    depth[t->root] = 0;
+    for (int node = t->root; node >= t->leaves; node--) {
+        for (int k = 0; k < 2; k++) {
+            code[t->child[node][k]] = (code[node] << 1) | (uint64_t)k;
+            depth[t->child[node][k]] = depth[node] + 1;
+        }
+    }
+    for (int i = 0; i < t->leaves; i++) {
+        codes[t->symbol[i]] = code[i];
+        lengths[t->symbol[i]] = depth[i];
+    }
+}
+
+// Builds the decoder for the codes of a tree. Returns -1 if a code is too
+// long to be decoded.
+int huff_decoder_from_tree(HuffDecoder* d, const HuffTree* t) {
+    uint64_t codes[256];
+    int lengths[256];
+    huff_tree_codes(t, codes, lengths);
+    huff_decoder_init(d);
+    for (int i = 0; i < t->leaves; i++) {
+        int s = t->symbol[i];
+        if (huff_decoder_add(d, codes[s], lengths[s], (unsigned char)s) != 0) return -1;
+    }
+    huff_decoder_finish(d);
+    return 0;
+}
+
+// Caps the code lengths of a Huffman tree at maxLength bits, which must
+// leave room for all used symbols (2^maxLength >= their count). Codes
+// past the cap are cut to it. While the lengths overfill the code space, a
+// code at the cap is dropped and the longest code below the cap is
+// lengthened by one bit into two codes, which takes the Kraft sum down by
+// one unit at the cost of a single rarely used code. The lengths are then
+// handed back out in the order of the tree: shortest codes to the most
+// frequent symbols.
+void huff_limit_lengths(const unsigned int* freq, int* lengths, int maxLength) {
+    int order[256];
+    int used = 0, longest = 0;
+    for (int s = 0; s < 256; s++) {
+        if (lengths[s] > longest) longest = lengths[s];
+        if (lengths[s] > 0) order[used++] = s;
+    }
+    if (longest <= maxLength) return;
+
+    // By length, then most frequent first, then by symbol
+    for (int i = 1; i < used; i++) {
+        int sym = order[i], j = i;
+        while (j > 0 && (lengths[order[j - 1]] > lengths[sym] ||
+                         (lengths[order[j - 1]] == lengths[sym] && freq[order[j - 1]] < freq[sym]))) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = sym;
+    }
+
+    // Kraft sum in units of 2^-maxLength; a complete prefix code adds up
+    // to exactly 2^maxLength
+    int count[256] = {0};
+    uint64_t total = 0;
+    for (int i = 0; i < used; i++) {
+        int len = lengths[order[i]] < maxLength ? lengths[order[i]] : maxLength;
+        count[len]++;
+        total += (uint64_t)1 << (maxLength - len);
+    }
+    while (total > ((uint64_t)1 << maxLength)) {
+        count[maxLength]--;
+        for (int len = maxLength - 1; len > 0; len--) {
+            if (count[len]) {
+                count[len]--;
+                count[len + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    int len = 1;
+    for (int i = 0; i < used; i++) {
+        while (count[len] == 0) len++;
+        lengths[order[i]] = len;
+        count[len]--;
+    }
+}
+
+int huff_decoder_from_lengths(HuffDecoder* d, const int* lengths) {
+    uint64_t codes[256];
+    if (huff_canonical_codes(lengths, codes) != 0) return -1;
+    huff_decoder_init(d);
+    for (int s = 0; s < 256; s++) {
+        if (lengths[s] && huff_decoder_add(d, codes[s], lengths[s], (unsigned char)s) != 0) return -1;
+    }
+    huff_decoder_finish(d);
+    return 0;
+}
+
+// Adaptive coding in a single pass with no table up front. Both sides
+// start with the same flat code and rebuild it from the symbols seen so
+// far, with older ones weighing half as much at each rebuild. The first
+// rebuild comes after HUFF_ADAPT_FIRST symbols, so the flat code is soon
+// left behind, and the gap doubles up to HUFF_ADAPT_SYMBOLS. Every symbol keeps a count of at
+// least one, so each has a code at all times. Only the current code is kept,
+// so memory stays the same however long the stream.
+typedef struct {
+    unsigned int counts[256]; // decayed statistics up to the last rebuild
+    unsigned int seen[256];   // symbols since the last rebuild
+    uint64_t codes[256];
+    int lengths[256];
+    HuffDecoder dec;          // kept up to date only when decoding
+    int decoding;
+    int maxLength;
+    size_t period;            // symbols between the last rebuild and the next
+    size_t left;              // symbols to go before the next rebuild
+} HuffAdaptive;
+
+static void huff_adaptive_rebuild(HuffAdaptive* a) {
+    unsigned int freq[256];
+    for (int s = 0; s < 256; s++) {
+        a->counts[s] = a->counts[s] / 2 + a->seen[s];
+        a->seen[s] = 0;
+        freq[s] = a->counts[s] + 1;
+    }
+    HuffTree tree;
+    huff_tree_build(&tree, freq);
+    huff_tree_codes(&tree, a->codes, a->lengths);
+    huff_limit_lengths(freq, a->lengths, a->maxLength);
+    huff_canonical_codes(a->lengths, a->codes);
+    if (a->decoding) huff_decoder_from_lengths(&a->dec, a->lengths);
+    a->period = a->period < HUFF_ADAPT_SYMBOLS ? a->period * 2 : HUFF_ADAPT_SYMBOLS;
+    a->left = a->period;
+}
+
+void huff_adaptive_init(HuffAdaptive* a, int maxLength, int decoding) {
+    memset(a->counts, 0, sizeof(a->counts));
+    memset(a->seen, 0, sizeof(a->seen));
+    a->maxLength = maxLength;
+    a->decoding = decoding;
+    a->period = HUFF_ADAPT_FIRST / 2;
+    huff_adaptive_rebuild(a);
+}
+
+void huff_adaptive_encode(HuffAdaptive* a, const unsigned char* data, size_t n, BitWriter* bw) {
+    while (n > 0) {
+        size_t run = n < a->left ? n : a->left;
+        for (size_t i = 0; i < run; i++) {
+            bit_writer_put(bw, a->codes[data[i]], a->lengths[data[i]]);
+        }
+        histogram_count(a->seen, data, run);
+        data += run;
+        n -= run;
+        a->left -= run;
+        if (a->left == 0) huff_adaptive_rebuild(a);
+    }
+}
+
+// Decodes up to n symbols into out and returns how many were produced,
+// as huff_decode_run does.
+size_t huff_adaptive_decode(HuffAdaptive* a, BitReader* br, unsigned char* out, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        size_t run = n - done < a->left ? n - done : a->left;
+        size_t got = huff_decode_run(&a->dec, br, out + done, run);
+        histogram_count(a->seen, out + done, got);
+        done += got;
+        a->left -= got;
+        if (got < run) break;
+        if (a->left == 0) huff_adaptive_rebuild(a);
+    }
+    return done;
+}
+
+// Block layout: rows per block, block count, then count + 1 byte offsets
+// of the blocks (relative to the first one) and the blocks themselves.
+// All blocks share the code table and each one starts on a byte boundary,
+// so blocks are coded and decoded on a thread pool and the output is the
+// same for any number of threads. With HUFF_STREAMS streams a block holds
+// the byte sizes of all streams but the last as uint32, then the streams;
+// column x of every row is coded in stream x % HUFF_STREAMS.
+typedef struct {
+    const unsigned char* in;
+    unsigned char* out;
+    size_t rowBytes;
+    size_t stride;            // distance between rows, in the input when
+    size_t blockRows;         // encoding and in the output when decoding
+    size_t rows;
+    int streams;              // 1 or HUFF_STREAMS
+    const uint64_t* codes;
+    const int* lengths;
+    const HuffDecoder* dec;
+    unsigned char** blocks;   // encoded blocks
+    size_t* sizes;
+    const uint64_t* offsets;  // block boundaries in the input when decoding
+    int* failed;
+} HuffBlockJob;
+
+// Rows per block, at least one.
+static inline uint32_t huff_block_rows(size_t rowBytes) {
+    size_t rows = rowBytes ? HUFF_BLOCK_BYTES / rowBytes : 1;
+    return rows ? (uint32_t)rows : 1;
+}
+
+static void huff_block_encode_task(void* ctx, int i) {
+    HuffBlockJob* job = (HuffBlockJob*)ctx;
+    size_t first = (size_t)i * job->blockRows;
+    size_t n = job->rows - first < job->blockRows ? job->rows - first : job->blockRows;
+
+    if (job->streams == 1) {
+        BitWriter bw;
+        if (bit_writer_init(&bw, NULL) != 0) {
+            job->failed[i] = 1;
+            return;
+        }
+        for (size_t y = first; y < first + n; y++) {
+            const unsigned char* row = job->in + y * job->stride;
+            for (size_t x = 0; x < job->rowBytes; x++) {
+                bit_writer_put(&bw, job->codes[row[x]], job->lengths[row[x]]);
+            }
+        }
+        job->failed[i] = bit_writer_flush(&bw) != 0;
+        job->blocks[i] = bw.buffer;
+        job->sizes[i] = bw.pos;
+        return;
+    }
+
+    BitWriter bw[HUFF_STREAMS];
+    int failed = 0, ready = 0;
+    while (ready < HUFF_STREAMS && bit_writer_init(&bw[ready], NULL) == 0) ready++;
+    if (ready == HUFF_STREAMS) {
+        for (size_t y = first; y < first + n; y++) {
+            const unsigned char* row = job->in + y * job->stride;
+            for (size_t x = 0; x < job->rowBytes; x++) {
+                bit_writer_put(&bw[x % HUFF_STREAMS], job->codes[row[x]], job->lengths[row[x]]);
+            }
+        }
+    }
+    // Sizes of the first streams, then the streams one after another
+    size_t total = (HUFF_STREAMS - 1) * sizeof(uint32_t);
+    for (int s = 0; s < ready; s++) {
+        failed |= bit_writer_flush(&bw[s]) != 0;
+        total += bw[s].pos;
+    }
+    unsigned char* block = ready == HUFF_STREAMS && !failed ? malloc(total) : NULL;
+    if (block) {
+        size_t pos = (HUFF_STREAMS - 1) * sizeof(uint32_t);
+        for (int s = 0; s < HUFF_STREAMS; s++) {
+            uint32_t size = (uint32_t)bw[s].pos;
+            if (s < HUFF_STREAMS - 1) memcpy(block + s * sizeof(uint32_t), &size, sizeof(uint32_t));
+            memcpy(block + pos, bw[s].buffer, bw[s].pos);
+            pos += bw[s].pos;
+        }
+    }
+    for (int s = 0; s < ready; s++) {
+        bit_writer_free(&bw[s]);
+    }
+    job->failed[i] = block == NULL;
+    job->blocks[i] = block;
+    job->sizes[i] = block ? total : 0;
+}
+
+static void huff_block_decode_task(void* ctx, int i) {
+    HuffBlockJob* job = (HuffBlockJob*)ctx;
+    size_t first = (size_t)i * job->blockRows;
+    size_t n = job->rows - first < job->blockRows ? job->rows - first : job->blockRows;
+
+    const unsigned char* block = job->in + job->offsets[i];
+    size_t size = (size_t)(job->offsets[i + 1] - job->offsets[i]);
+    if (job->streams == 1) {
+        BitReader br;
+        bit_reader_init(&br, block, size);
+        for (size_t y = first; y < first + n; y++) {
+            if (huff_decode_run(job->dec, &br, job->out + y * job->stride, job->rowBytes) != job->rowBytes) {
+                job->failed[i] = 1;
+                return;
+            }
+        }
+        job->failed[i] = bit_reader_overrun(&br);
+        return;
+    }
+
+    BitReader br[HUFF_STREAMS];
+    size_t pos = (HUFF_STREAMS - 1) * sizeof(uint32_t);
+    if (size < pos) {
+        job->failed[i] = 1;
+        return;
+    }
+    for (int s = 0; s < HUFF_STREAMS; s++) {
+        uint32_t length;
+        if (s < HUFF_STREAMS - 1) {
+            memcpy(&length, block + s * sizeof(uint32_t), sizeof(uint32_t));
+        } else {
+            length = (uint32_t)(size - pos);
+        }
+        if (length > size - pos) {
+            job->failed[i] = 1;
+            return;
+        }
+        bit_reader_init(&br[s], block + pos, length);
+        pos += length;
+    }
+    for (size_t y = first; y < first + n; y++) {
+        if (huff_decode_streams(job->dec, br, job->out + y * job->stride, job->rowBytes) != job->rowBytes) {
+            job->failed[i] = 1;
+            return;
+        }
+    }
+    for (int s = 0; s < HUFF_STREAMS; s++) {
+        job->failed[i] |= bit_reader_overrun(&br[s]);
+    }
+}
+
+// Encodes rows x rowBytes bytes of data, rows stride bytes apart, in the
+// block layout with 1 or HUFF_STREAMS streams a block. Returns 0, or -1 if
+// memory ran out or the file could not be written.
+int huff_blocks_encode(const unsigned char* data, size_t rowBytes, size_t stride, size_t rows,
+                       int streams, const uint64_t* codes, const int* lengths, FILE* file) {
+    uint32_t blockRows = huff_block_rows(rowBytes);
+    uint32_t count = (uint32_t)((rows + blockRows - 1) / blockRows);
+    HuffBlockJob job;
+    job.in = data;
+    job.out = NULL;
+    job.rowBytes = rowBytes;
+    job.stride = stride;
+    job.blockRows = blockRows;
+    job.rows = rows;
+    job.streams = streams;
+    job.codes = codes;
+    job.lengths = lengths;
+    job.dec = NULL;
+    job.blocks = calloc(count + 1, sizeof(unsigned char*));
+    job.sizes = calloc(count + 1, sizeof(size_t));
+    job.failed = calloc(count + 1, sizeof(int));
+    uint64_t* offsets = malloc((count + 1) * sizeof(uint64_t));
+    job.offsets = offsets;
+
+    int failed = !job.blocks || !job.sizes || !job.failed || !offsets;
+    if (!failed) {
+        parallel_for((int)count, huff_block_encode_task, &job);
+        offsets[0] = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            failed |= job.failed[i];
+            offsets[i + 1] = offsets[i] + job.sizes[i];
+        }
+    }
+    if (!failed) {
+        failed = fwrite(&blockRows, sizeof(blockRows), 1, file) != 1 ||
+                 fwrite(&count, sizeof(count), 1, file) != 1 ||
+                 fwrite(offsets, sizeof(uint64_t), count + 1, file) != count + 1;
+        for (uint32_t i = 0; i < count && !failed; i++) {
+            failed = fwrite(job.blocks[i], 1, job.sizes[i], file) != job.sizes[i];
+        }
+    }
+
+    for (uint32_t i = 0; job.blocks && i < count; i++) {
+        free(job.blocks[i]);
+    }
+    free(job.blocks);
+    free(job.sizes);
+    free(job.failed);
+    free(offsets);
+    return failed ? -1 : 0;
+}
+
+// Decodes a block layout held in memory, with 1 or HUFF_STREAMS streams a
+// block, into rows x rowBytes bytes of out, rows stride bytes apart.
+// Returns 0, or -1 on a corrupt stream or when memory ran out.
+int huff_blocks_decode(const unsigned char* in, size_t size, int streams, const HuffDecoder* dec,
+                       unsigned char* out, size_t rowBytes, size_t stride, size_t rows) {
+    uint32_t blockRows, count;
+    if (size < 2 * sizeof(uint32_t)) return -1;
+    memcpy(&blockRows, in, sizeof(uint32_t));
+    memcpy(&count, in + sizeof(uint32_t), sizeof(uint32_t));
+    if (blockRows == 0 || count != (rows + blockRows - 1) / blockRows) return -1;
+
+    size_t table = 2 * sizeof(uint32_t) + ((size_t)count + 1) * sizeof(uint64_t);
+    if (size < table) return -1;
+    uint64_t* offsets = malloc(((size_t)count + 1) * sizeof(uint64_t));
+    int* failed = calloc((size_t)count + 1, sizeof(int));
+    int result = -1;
+    if (offsets && failed) {
+        memcpy(offsets, in + 2 * sizeof(uint32_t), ((size_t)count + 1) * sizeof(uint64_t));
+        int valid = offsets[0] == 0;
+        for (uint32_t i = 0; valid && i < count; i++) {
+            valid = offsets[i + 1] >= offsets[i];
+        }
+        if (valid && offsets[count] <= size - table) {
+            HuffBlockJob job;
+            job.in = in + table;
+            job.out = out;
+            job.rowBytes = rowBytes;
+            job.stride = stride;
+            job.blockRows = blockRows;
+            job.rows = rows;
+            job.streams = streams;
+            job.codes = NULL;
+            job.lengths = NULL;
+            job.dec = dec;
+            job.blocks = NULL;
+            job.sizes = NULL;
+            job.offsets = offsets;
+            job.failed = failed;
+            parallel_for((int)count, huff_block_decode_task, &job);
+            result = 0;
+            for (uint32_t i = 0; i < count; i++) {
+                if (failed[i]) result = -1;
+            }
+        }
+    }
+    free(offsets);
+    free(failed);
+    return result;
+}
+
+// Code-length header: first and last used symbol, the bit width of one
+// length, then a length for every symbol in that range packed MSB first.
+// A width of 0 marks a single-symbol alphabet whose code is empty.
+int huff_write_lengths(FILE* file, const unsigned int* freq, const int* lengths) {
+    int lo = -1, hi = -1, maxLen = 0;
+    for (int s = 0; s < 256; s++) {
+        if (!freq[s]) continue;
+        if (lo < 0) lo = s;
+        hi = s;
+        if (lengths[s] > maxLen) maxLen = lengths[s];
+    }
+    if (lo < 0 || maxLen > HUFF_MAX_STORED_LENGTH) return -1;
+
+    int width = 0;
+    while ((1 << width) <= maxLen) width++;
+
+    unsigned char buf[3 + 256];
+    int n = 0;
+    buf[n++] = (unsigned char)lo;
+    buf[n++] = (unsigned char)hi;
+    buf[n++] = (unsigned char)width;
+    unsigned int acc = 0;
+    int bits = 0;
+    for (int s = lo; width && s <= hi; s++) {
+        acc = (acc << width) | (unsigned int)(freq[s] ? lengths[s] : 0);
+        bits += width;
+        while (bits >= 8) {
+            buf[n++] = (unsigned char)(acc >> (bits - 8));
+            bits -= 8;
+        }
+        acc &= (1u << bits) - 1;
+    }
+    if (bits > 0) buf[n++] = (unsigned char)(acc << (8 - bits));
+    return fwrite(buf, 1, n, file) == (size_t)n ? 0 : -1;
+}
+
+// Reads a code-length header and builds the decoder straight from it.
+int huff_read_lengths(FILE* file, HuffDecoder* d) {
+    unsigned char hdr[3];
+    if (fread(hdr, 1, 3, file) != 3) return -1;
+    int lo = hdr[0], hi = hdr[1], width = hdr[2];
+    if (hi < lo || width > 6) return -1;
+
+    if (width == 0) {
+        huff_decoder_init(d);
+        return lo == hi ? huff_decoder_add(d, 0, 0, (unsigned char)lo) : -1;
+    }
+
+    unsigned char buf[256];
+    size_t bytes = ((size_t)(hi - lo + 1) * width + 7) / 8;
+    if (fread(buf, 1, bytes, file) != bytes) return -1;
+
+    int lengths[256] = {0};
+    BitReader br;
+    bit_reader_init(&br, buf, bytes);
+    for (int s = lo; s <= hi; s++) {
+        bit_reader_refill(&br);
+        lengths[s] = (int)bit_reader_peek(&br, width);
+        bit_reader_skip(&br, width);
+    }
+    return huff_decoder_from_lengths(d, lengths);
+}
+
+#endif
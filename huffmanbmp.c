@@ -3,218 +3,216 @@
 #include <stdint.h>
 #include <string.h>
 #include "image.h"
+#include "ans.h"
+#include "histogram.h"
+#include "huffcode.h"
+#include "bmpsource.h"
+#include "bmpsink.h"
 
-#define MAX_TREE_NODES 511 // 256 leaf nodes + 255 internal nodes
+#define BMP_CONTEXT_STEP 3 // bytes from a sample to the same channel of the pixel on its left
 
-typedef struct HuffmanNode {
-    unsigned int freq;
-    unsigned char symbol;
-    struct HuffmanNode* left;
-    struct HuffmanNode* right;
-} HuffmanNode;
-
-typedef struct {
-    FILE* file;
-    unsigned char buffer;
-    int bit_count;
-} BitBuffer;
-
-HuffmanNode* create_node(unsigned char symbol, unsigned int freq) {
-    HuffmanNode* node = malloc(sizeof(HuffmanNode));
-    node->symbol = symbol;
-    node->freq = freq;
-    node->left = node->right = NULL;
-    return node;
-}
-
-void free_tree(HuffmanNode* node) {
-    if (!node) return;
-    free_tree(node->left);
-    free_tree(node->right);
-    free(node);
-}
-
-void build_freq_table(unsigned char* data, unsigned int size, unsigned int* freq) {
+void build_freq_table(const BmpSource* src, unsigned int* freq) {
     memset(freq, 0, 256 * sizeof(unsigned int));
-    for (unsigned int i = 0; i < size; i++) {
-        freq[data[i]]++;
-    }
-}
-
-HuffmanNode* build_huffman_tree(unsigned int* freq) {
-    HuffmanNode* nodes[MAX_TREE_NODES];
-    int node_count = 0;
-
-    for (int i = 0; i < 256; i++) {
-        if (freq[i]) {
-            nodes[node_count++] = create_node((unsigned char)i, freq[i]);
-        }
-    }
-
-    while (node_count > 1) {
-        int min1 = 0, min2 = 1;
-        if (nodes[min2]->freq < nodes[min1]->freq) {
-            int temp = min1;
-            min1 = min2;
-            min2 = temp;
-        }
-        for (int i = 2; i < node_count; i++) {
-            if (nodes[i]->freq < nodes[min1]->freq) {
-                min2 = min1;
-                min1 = i;
-            } else if (nodes[i]->freq < nodes[min2]->freq) {
-                min2 = i;
-            }
-        }
-
-        HuffmanNode* parent = create_node(0, nodes[min1]->freq + nodes[min2]->freq);
-        parent->left = nodes[min1];
-        parent->right = nodes[min2];
-
-        nodes[min1] = parent;
-        nodes[min2] = nodes[node_count - 1];
-        node_count--;
-    }
-
-    return nodes[0];
-}
-
-void generate_codes(HuffmanNode* root, unsigned int code, int length, unsigned int* codes, int* lengths) {
-    if (!root->left && !root->right) {
-        codes[root->symbol] = code;
-        lengths[root->symbol] = length;
-        return;
-    }
-    if (root->left) {
-        generate_codes(root->left, code << 1, length + 1, codes, lengths);
-    }
-    if (root->right) {
-        generate_codes(root->right, (code << 1) | 1, length + 1, codes, lengths);
-    }
-}
-
-void init_bit_buffer(BitBuffer* bb, FILE* file) {
-    bb->file = file;
-    bb->buffer = 0;
-    bb->bit_count = 0;
-}
-
-void write_bit(BitBuffer* bb, int bit) {
-    bb->buffer = (bb->buffer << 1) | bit;
-    bb->bit_count++;
-    if (bb->bit_count == 8) {
-        fwrite(&bb->buffer, 1, 1, bb->file);
-        bb->buffer = 0;
-        bb->bit_count = 0;
-    }
-}
-
-void flush_bit_buffer(BitBuffer* bb) {
-    if (bb->bit_count > 0) {
-        bb->buffer <<= (8 - bb->bit_count);
-        fwrite(&bb->buffer, 1, 1, bb->file);
-        bb->buffer = 0;
-        bb->bit_count = 0;
-    }
+    histogram_count_rows(freq, src->pixels, src->row_bytes, src->stride, src->rows);
 }
 
-int read_bit(BitBuffer* bb) {
-    if (bb->bit_count == 0) {
-        fread(&bb->buffer, 1, 1, bb->file);
-        bb->bit_count = 8;
+int compressBMP3(const char* input_file, const char* output_file, int mode, int max_length) {
+    if (mode != HUFF_MODE_FREQ && mode != HUFF_MODE_ANS && mode != HUFF_MODE_CONTEXT &&
+        (max_length < HUFF_MIN_LIMIT || max_length > HUFF_MAX_LIMIT)) {
+        printf("Error: Maximum code length must be between %d and %d bits\n", HUFF_MIN_LIMIT, HUFF_MAX_LIMIT);
+        return -1;
     }
-    bb->bit_count--;
-    return (bb->buffer >> bb->bit_count) & 1;
-}
-
-int compressBMP3(const char* input_file, const char* output_file) {
-    FILE* fin = fopen(input_file, "rb");
-    FILE* fout = fopen(output_file, "wb");
-    if (!fin || !fout) {
-        printf("Error: Cannot open input/output files\n");
+    BmpSource src;
+    if (bmp_source_open(&src, input_file) != 0) {
         return -1;
     }
-
-    BmpFile file;
-    BmpInfo info;
-    fread(&file, sizeof(BmpFile), 1, fin);
-    fread(&info, sizeof(BmpInfo), 1, fin);
+    BmpFile file = src.file;
+    BmpInfo info = src.info;
 
     if (info.BitCount != 24 || info.Compression != 0) {
         printf("Error: Only 24-bit uncompressed BMP supported\n");
-        fclose(fin);
+        bmp_source_close(&src);
         return -1;
     }
 
-    unsigned int dS = info.Width * abs(info.Height) * 3; // data size
-    unsigned char* pD = malloc(dS); // pixel data
-    fseek(fin, file.Offbits, SEEK_SET);
-    int padding = (4 - (info.Width * 3) % 4) % 4;
-    for (int i = 0; i < abs(info.Height); i++) {
-        fread(pD + (i * info.Width * 3), info.Width * 3, 1, fin);
-        fseek(fin, padding, SEEK_CUR);
+    FILE* fout = open_output_stream(output_file);
+    if (!fout) {
+        printf("Error: Cannot open input/output files\n");
+        bmp_source_close(&src);
+        return -1;
     }
 
-    fseek(fin, 0, SEEK_END);
-    long size = ftell(fin);
-    fseek(fin, sizeof(BmpFile), SEEK_SET);
-    fclose(fin);
+    // The pixel rows are read in place from the mapped input
+    size_t dS = bmp_source_size(&src); // data size
+    long size = is_std_stream(input_file) ? -1 : (long)src.map.size;
 
+    // The adaptive mode codes in one pass and needs no statistics up front;
+    // the rANS mode quantizes them into its own frequency table, and the
+    // context mode counts prediction errors per context instead
     unsigned int freq[256];
-    build_freq_table(pD, dS, freq);
-    HuffmanNode* root = build_huffman_tree(freq);
-
-    unsigned int codes[256] = {0};
-    int lengths[256] = {0};
-    generate_codes(root, 0, 0, codes, lengths);
+    uint64_t codes[256];
+    int lengths[256];
+    AnsModel ans_model;
+    AnsModel* ctx_models = NULL;
+    if (mode == HUFF_MODE_CONTEXT) {
+        ctx_models = malloc(ANS_CONTEXTS * sizeof(AnsModel));
+        if (!ctx_models || ans_context_models(ctx_models, src.pixels, src.row_bytes, src.stride, src.rows,
+                                              BMP_CONTEXT_STEP) != 0) {
+            printf("Error: Failed to build context models\n");
+            free(ctx_models);
+            bmp_source_close(&src);
+            fclose(fout);
+            return -1;
+        }
+    } else if (mode != HUFF_MODE_ADAPTIVE) {
+        build_freq_table(&src, freq);
+        HuffTree tree;
+        // A frequency table is turned back into a tree on decode, the way the
+        // original coder paired the nodes
+        int empty = mode == HUFF_MODE_ANS    ? ans_model_build(&ans_model, freq) != 0
+                    : mode == HUFF_MODE_FREQ ? huff_tree_build_scan(&tree, freq) != 0
+                                             : huff_tree_build(&tree, freq) != 0;
+        if (empty) {
+            printf("Error: No pixel data to compress\n");
+            bmp_source_close(&src);
+            fclose(fout);
+            return -1;
+        }
+        if (mode != HUFF_MODE_ANS) huff_tree_codes(&tree, codes, lengths);
+        if (mode != HUFF_MODE_ANS && mode != HUFF_MODE_FREQ) {
+            huff_limit_lengths(freq, lengths, max_length);
+            huff_canonical_codes(lengths, codes);
+        }
+    }
 
-    file.Offbits = sizeof(BmpFile) + sizeof(BmpInfo) + sizeof(unsigned int) + 256 * sizeof(unsigned int);
     info.Compression = 2;
-    BitBuffer bb;
-    init_bit_buffer(&bb, fout);
 
-    fwrite(&file, sizeof(BmpFile), 1, fout);
-    fwrite(&info, sizeof(BmpInfo), 1, fout);
-    fwrite(&dS, sizeof(unsigned int), 1, fout);
-    fwrite(freq, sizeof(unsigned int), 256, fout);
-
-    for (unsigned int i = 0; i < dS; i++) {
-        unsigned int code = codes[pD[i]];
-        int len = lengths[pD[i]];
-        for (int j = len - 1; j >= 0; j--) {
-            write_bit(&bb, (code >> j) & 1);
+    unsigned char version = HUFF_VERSION;
+    unsigned char mode_byte = (unsigned char)mode;
+    unsigned int stored_size = (unsigned int)dS; // low 32 bits, the decoder goes by the dimensions
+    if (fwrite(&file, sizeof(BmpFile), 1, fout) != 1 ||
+        fwrite(&info, sizeof(BmpInfo), 1, fout) != 1 ||
+        fwrite(HUFF_MAGIC, 1, HUFF_MAGIC_BYTES, fout) != HUFF_MAGIC_BYTES ||
+        fwrite(&version, 1, 1, fout) != 1 ||
+        fwrite(&stored_size, sizeof(unsigned int), 1, fout) != 1 ||
+        fwrite(&mode_byte, 1, 1, fout) != 1) {
+        printf("Error: Failed to write header\n");
+        free(ctx_models);
+        bmp_source_close(&src);
+        fclose(fout);
+        return -1;
+    }
+    if (mode == HUFF_MODE_ADAPTIVE) {
+        unsigned char cap = (unsigned char)max_length;
+        if (fwrite(&cap, 1, 1, fout) != 1) {
+            printf("Error: Failed to write header\n");
+            bmp_source_close(&src);
+            fclose(fout);
+            return -1;
+        }
+    } else if (mode == HUFF_MODE_CONTEXT) {
+        if (ans_write_context_models(fout, ctx_models) != 0) {
+            printf("Error: Failed to write frequency tables\n");
+            free(ctx_models);
+            bmp_source_close(&src);
+            fclose(fout);
+            return -1;
+        }
+    } else if (mode == HUFF_MODE_ANS) {
+        if (ans_write_model(fout, &ans_model) != 0) {
+            printf("Error: Failed to write frequency table\n");
+            bmp_source_close(&src);
+            fclose(fout);
+            return -1;
+        }
+    } else if (mode != HUFF_MODE_FREQ) {
+        if (huff_write_lengths(fout, freq, lengths) != 0) {
+            printf("Error: Failed to write code length table\n");
+            bmp_source_close(&src);
+            fclose(fout);
+            return -1;
+        }
+    } else {
+        if (fwrite(freq, sizeof(unsigned int), 256, fout) != 256) {
+            printf("Error: Failed to write frequency table\n");
+            bmp_source_close(&src);
+            fclose(fout);
+            return -1;
         }
     }
-    flush_bit_buffer(&bb);
-
-    unsigned int com_size = ftell(fout) - file.Offbits;
-    info.SizeImage = com_size;
-    file.Size = file.Offbits + com_size;
-    fseek(fout, 0, SEEK_SET);
-    fwrite(&file, sizeof(BmpFile), 1, fout);
-    fwrite(&info, sizeof(BmpInfo), 1, fout);
+    file.Offbits = ftell(fout);
+
+    int write_failed;
+    if (mode == HUFF_MODE_CONTEXT) {
+        write_failed = ans_context_blocks_encode(src.pixels, src.row_bytes, src.stride, src.rows,
+                                                 BMP_CONTEXT_STEP, ctx_models, fout) != 0;
+        free(ctx_models);
+    } else if (mode == HUFF_MODE_ANS) {
+        write_failed = ans_blocks_encode(src.pixels, src.row_bytes, src.stride, src.rows,
+                                         &ans_model, fout) != 0;
+    } else if (mode == HUFF_MODE_BLOCKS || mode == HUFF_MODE_STREAMS) {
+        write_failed = huff_blocks_encode(src.pixels, src.row_bytes, src.stride, src.rows,
+                                          mode == HUFF_MODE_STREAMS ? HUFF_STREAMS : 1,
+                                          codes, lengths, fout) != 0;
+    } else {
+        BitWriter bw;
+        HuffAdaptive* model = mode == HUFF_MODE_ADAPTIVE ? malloc(sizeof(HuffAdaptive)) : NULL;
+        if ((mode == HUFF_MODE_ADAPTIVE && !model) || bit_writer_init(&bw, fout) != 0) {
+            printf("Error: Memory allocation failed\n");
+            free(model);
+            bmp_source_close(&src);
+            fclose(fout);
+            return -1;
+        }
+        if (model) huff_adaptive_init(model, max_length, 0);
+        for (size_t y = 0; y < src.rows; y++) {
+            const unsigned char* row = bmp_source_row(&src, y);
+            if (model) {
+                huff_adaptive_encode(model, row, src.row_bytes, &bw);
+                continue;
+            }
+            for (size_t i = 0; i < src.row_bytes; i++) {
+                bit_writer_put(&bw, codes[row[i]], lengths[row[i]]);
+            }
+        }
+        write_failed = bit_writer_flush(&bw);
+        bit_writer_free(&bw);
+        free(model);
+    }
+    if (write_failed) {
+        printf("Error: Failed to write compressed data\n");
+        bmp_source_close(&src);
+        fclose(fout);
+        return -1;
+    }
 
-    printf("\nOriginal size: %ld bytes\n", size);
+    // The sizes go into the header afterwards, unless the output is a
+    // pipe, which the decoder does not mind
+    long compressed_size = stream_size(fout);
+    if (compressed_size >= 0 && fseek(fout, 0, SEEK_SET) == 0) {
+        unsigned int com_size = compressed_size - file.Offbits;
+        info.SizeImage = com_size;
+        file.Size = file.Offbits + com_size;
+        if (fwrite(&file, sizeof(BmpFile), 1, fout) != 1 || fwrite(&info, sizeof(BmpInfo), 1, fout) != 1) {
+            printf("Error: Failed to write header\n");
+            bmp_source_close(&src);
+            fclose(fout);
+            return -1;
+        }
+    }
 
-    FILE *check_size = fopen("compressed.bin", "rb");
-    fseek(check_size, 0, SEEK_END);
-    long compressed_size2 = ftell(check_size);
-    fclose(check_size);
-    
-    printf("Compressed size: %ld bytes\n", compressed_size2);
-    printf("Compression ratio: %.2f%%\n", (1.0 - ((float)compressed_size2 / size)) * 100); 
+    printf("\n");
+    print_compression_report(size, compressed_size);
 
-    free(pD);
-    free_tree(root);
+    bmp_source_close(&src);
     fclose(fout);
 
     return 0;
 }
 
 int decompressBMP3(const char* input_file, const char* output_file) {
-    FILE* fin = fopen(input_file, "rb");
-    FILE* fout = fopen(output_file, "wb");
-    if (!fin || !fout) {
+    FILE* fin = open_input_stream(input_file);
+    if (!fin) {
         printf("Error: Cannot open input/output files\n");
         return -1;
     }
@@ -226,61 +224,179 @@ int decompressBMP3(const char* input_file, const char* output_file) {
 
     if (info.Compression != 2) {
         printf("Error: Not a Huffman-compressed BMP\n");
-        fclose(fin);
+        close_stream(fin);
         return -1;
     }
 
-    unsigned int og_size;
-    fread(&og_size, sizeof(unsigned int), 1, fin);
-
-    unsigned int freq[256];
-    fread(freq, sizeof(unsigned int), 256, fin);
+    // Without the marker the first word is already the size. Those files
+    // hold a frequency table, right after the size in the oldest layout
+    // and after a zero mode byte when Offbits counts that byte.
+    unsigned char marker[HUFF_MAGIC_BYTES];
+    unsigned char version = HUFF_VERSION;
+    unsigned char mode = HUFF_MODE_FREQ;
+    if (fread(marker, 1, HUFF_MAGIC_BYTES, fin) != HUFF_MAGIC_BYTES) {
+        printf("Error: Failed to read header\n");
+        close_stream(fin);
+        return -1;
+    }
+    int marked = memcmp(marker, HUFF_MAGIC, HUFF_MAGIC_BYTES) == 0;
+    if (marked && (fread(&version, 1, 1, fin) != 1 || version != HUFF_VERSION)) {
+        printf("Error: Unsupported Huffman format version\n");
+        close_stream(fin);
+        return -1;
+    }
 
-    HuffmanNode* root = build_huffman_tree(freq);
-    unsigned char* pD = malloc(og_size); // pixel data
-    BitBuffer bb;
-    init_bit_buffer(&bb, fin);
+    // The stored size only holds the low 32 bits; the full size comes
+    // from the dimensions
+    unsigned int stored_size;
+    size_t og_size = bmp_row_bytes(&info) * bmp_rows(&info);
+    if (marked) {
+        if (fread(&stored_size, sizeof(unsigned int), 1, fin) != 1) stored_size = 0;
+    } else {
+        memcpy(&stored_size, marker, sizeof(unsigned int));
+    }
+    if (info.Width <= 0 || stored_size != (unsigned int)og_size) {
+        printf("Error: Invalid image size\n");
+        close_stream(fin);
+        return -1;
+    }
+    size_t table_offbits = sizeof(BmpFile) + sizeof(BmpInfo) + sizeof(unsigned int) + 256 * sizeof(unsigned int);
+    if ((marked || file.Offbits == table_offbits + 1) &&
+        (fread(&mode, 1, 1, fin) != 1 || mode > HUFF_MODE_CONTEXT || (!marked && mode != HUFF_MODE_FREQ))) {
+        printf("Error: Unknown Huffman table format\n");
+        close_stream(fin);
+        return -1;
+    }
 
-    unsigned int pos = 0;
-    HuffmanNode* current = root;
-    while (pos < og_size) {
-        int bit = read_bit(&bb);
-        current = bit ? current->right : current->left;
-        if (!current->left && !current->right) {
-            pD[pos++] = current->symbol;
-            current = root;
+    HuffDecoder dec;
+    AnsModel ans_model;
+    AnsModel* ctx_models = NULL;
+    HuffAdaptive* model = NULL;
+    unsigned char cap;
+    if (mode == HUFF_MODE_CONTEXT) {
+        ctx_models = malloc(ANS_CONTEXTS * sizeof(AnsModel));
+        if (!ctx_models || ans_read_context_models(fin, ctx_models) != 0) {
+            printf("Error: Invalid frequency tables\n");
+            free(ctx_models);
+            close_stream(fin);
+            return -1;
+        }
+    } else if (mode == HUFF_MODE_ADAPTIVE) {
+        model = malloc(sizeof(HuffAdaptive));
+        if (fread(&cap, 1, 1, fin) != 1 || cap < HUFF_MIN_LIMIT || cap > HUFF_MAX_LIMIT || !model) {
+            printf("Error: Invalid adaptive Huffman header\n");
+            free(model);
+            close_stream(fin);
+            return -1;
+        }
+        huff_adaptive_init(model, cap, 1);
+    } else if (mode == HUFF_MODE_ANS) {
+        if (ans_read_model(fin, &ans_model) != 0) {
+            printf("Error: Invalid frequency table\n");
+            close_stream(fin);
+            return -1;
+        }
+    } else if (mode != HUFF_MODE_FREQ) {
+        if (huff_read_lengths(fin, &dec) != 0) {
+            printf("Error: Invalid code length table\n");
+            close_stream(fin);
+            return -1;
+        }
+    } else {
+        unsigned int freq[256];
+        HuffTree tree;
+        if (fread(freq, sizeof(unsigned int), 256, fin) != 256 ||
+            huff_tree_build_scan(&tree, freq) != 0 || huff_decoder_from_tree(&dec, &tree) != 0) {
+            printf("Error: Invalid Huffman table\n");
+            close_stream(fin);
+            return -1;
         }
     }
 
     file.Offbits = sizeof(BmpFile) + sizeof(BmpInfo);
-    file.Size = file.Offbits + og_size + (abs(info.Height) * ((4 - (info.Width * 3) % 4) % 4));
+    file.Size = (unsigned int)(file.Offbits + bmp_stride(&info) * bmp_rows(&info));
     info.Compression = 0;
     info.SizeImage = 0;
 
-    fwrite(&file, sizeof(BmpFile), 1, fout);
-    fwrite(&info, sizeof(BmpInfo), 1, fout);
-
-    int padding = (4 - (info.Width * 3) % 4) % 4;
-    int row_size = info.Width * 3;
-    unsigned char pad[4] = {0};
-    for (int i = 0; i < abs(info.Height); i++) {
-        fwrite(pD + (i * row_size), row_size, 1, fout);
-        fwrite(pad, padding, 1, fout);
+    BmpSink dst;
+    if (bmp_sink_open(&dst, output_file, &file, &info) != 0) {
+        free(model);
+        free(ctx_models);
+        close_stream(fin);
+        return -1;
+    }
+    if (mode == HUFF_MODE_BLOCKS || mode == HUFF_MODE_STREAMS || mode == HUFF_MODE_ANS ||
+        mode == HUFF_MODE_CONTEXT) {
+        // The block offsets only mean something once all of it is in; the
+        // blocks are then decoded in parallel straight into their rows
+        size_t comp_size;
+        unsigned char* comp = read_remaining(fin, &comp_size);
+        close_stream(fin);
+        unsigned char* pixels = bmp_sink_rows(&dst, 0, dst.rows);
+        int failed = !comp || !pixels;
+        if (!failed && mode == HUFF_MODE_CONTEXT) {
+            failed = ans_context_blocks_decode(comp, comp_size, ctx_models, BMP_CONTEXT_STEP,
+                                               pixels, dst.row_bytes, dst.stride, dst.rows) != 0;
+        } else if (!failed && mode == HUFF_MODE_ANS) {
+            failed = ans_blocks_decode(comp, comp_size, &ans_model,
+                                       pixels, dst.row_bytes, dst.stride, dst.rows) != 0;
+        } else if (!failed) {
+            failed = huff_blocks_decode(comp, comp_size, mode == HUFF_MODE_STREAMS ? HUFF_STREAMS : 1, &dec,
+                                        pixels, dst.row_bytes, dst.stride, dst.rows) != 0;
+        }
+        free(ctx_models);
+        free(comp);
+        if (failed) {
+            printf("Error: Corrupt Huffman block data\n");
+            bmp_sink_discard(&dst);
+            return -1;
+        }
+        if (bmp_sink_close(&dst) != 0) {
+            return -1;
+        }
+        printf("Decompressed to %zu bytes\n", og_size);
+        return 0;
     }
 
-    free(pD);
-    free_tree(root);
-    fclose(fin);
-    fclose(fout);
-    printf("Decompressed to %u bytes\n", og_size);
+    // Each row is decoded straight into its place in the output file as
+    // the codes are read in
+    BitReader br;
+    if (bit_reader_open(&br, fin) != 0) {
+        printf("Error: Memory allocation failed\n");
+        free(model);
+        bmp_sink_discard(&dst);
+        close_stream(fin);
+        return -1;
+    }
+    size_t pos = 0;
+    for (size_t y = 0; y < dst.rows; y++) {
+        unsigned char* row = bmp_sink_row(&dst, y);
+        size_t got = model ? huff_adaptive_decode(model, &br, row, dst.row_bytes)
+                           : huff_decode_run(&dec, &br, row, dst.row_bytes);
+        pos += got;
+        if (got != dst.row_bytes) break;
+    }
+    free(model);
+    int overrun = bit_reader_overrun(&br);
+    bit_reader_close(&br);
+    close_stream(fin);
+    if (pos != og_size || overrun) {
+        printf("Error: Corrupt Huffman data at byte %zu\n", pos);
+        bmp_sink_discard(&dst);
+        return -1;
+    }
+    if (bmp_sink_close(&dst) != 0) {
+        return -1;
+    }
+    printf("Decompressed to %zu bytes\n", og_size);
     return 0;
 }
 
 int huffmanBMP() {
     char inputFile[256];
-    char compressedFile[256] = "compressed.bin";
+    char compressedFile[256];
     char decompressedFile[256];
-    int yn;
+    int yn, mode, maxLength = HUFF_MAX_LIMIT;
 
     printf("What do you want to do??\n1.Compress an image.\n2.Decompress an image.\n");
     printf("Enter your choice in number: ");  
@@ -291,8 +407,26 @@ int huffmanBMP() {
         scanf("%255s", inputFile);
         printf("\n");
 
+        printf("Enter the compressed file name: ");
+        scanf("%255s", compressedFile);
+        printf("\n");
+
+        printf("Which Huffman mode??\n1.Frequency table.\n2.Canonical codes.\n3.Canonical codes, blocks coded in parallel.\n4.Canonical codes, parallel blocks of four interleaved streams.\n5.Adaptive codes, single pass.\n6.Asymmetric numeral systems (rANS) instead of Huffman codes.\n7.rANS, tables chosen by the neighbouring pixels.\n");
+        printf("Enter your choice in number: ");
+        scanf("%d", &mode);
+        printf("\n");
+        if (mode < 1 || mode > 7) {
+            printf("Invalid choice.\n");
+            return 0;
+        }
+        if (mode > 1 && mode < 6) {
+            printf("Enter the maximum code length in bits (%d-%d): ", HUFF_MIN_LIMIT, HUFF_MAX_LIMIT);
+            scanf("%d", &maxLength);
+            printf("\n");
+        }
+
         printf("Attempting to compress %s...\n", inputFile);
-        if (compressBMP3(inputFile, compressedFile) == 0) {
+        if (compressBMP3(inputFile, compressedFile, mode - 1, maxLength) == 0) {
             printf("Compression successful: %s -> %s\n", inputFile, compressedFile);
 
         } else {
@@ -300,6 +434,9 @@ int huffmanBMP() {
         }
     }
     else if(yn == 2){ 
+        printf("Enter the compressed file name: ");
+        scanf("%255s", compressedFile);
+        printf("\n");
         printf("Enter decompressed BMP file name: ");
         scanf("%255s", decompressedFile);
         printf("\n");
@@ -308,18 +445,10 @@ int huffmanBMP() {
         if (decompressBMP3(compressedFile, decompressedFile) == 0) {
             printf("Decompression successful: %s -> %s\n", compressedFile, decompressedFile);
 
-            FILE* comp = fopen(compressedFile, "rb");
-            fseek(comp, 0, SEEK_END);
-            long compSize = ftell(comp);
-            fclose(comp);
-        
-            FILE* decomp = fopen(decompressedFile, "rb");
-            fseek(decomp, 0, SEEK_END);
-            long decompSize = ftell(decomp);
-            fclose(decomp);
-
-            printf("Compressed size: %ld bytes\n", compSize);
-            printf("Decompressed size: %ld bytes\n", decompSize);
+            long compSize = path_size(compressedFile);
+            long decompSize = path_size(decompressedFile);
+            if (compSize >= 0) printf("Compressed size: %ld bytes\n", compSize);
+            if (decompSize >= 0) printf("Decompressed size: %ld bytes\n", decompSize);
         } else {
             printf("Decompression failed\n");
         }
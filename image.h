@@ -34,12 +34,19 @@ typedef struct {
 
 #pragma pack(pop) 
 
-// Dictionary entry structure
-typedef struct {
-    int prefix;
-    unsigned char value;
-    int code;
-} DictionaryEntry;
+// Row geometry of an uncompressed BMP, in 64-bit sizes so large images do
+// not wrap around. A negative height is a top-down image.
+static inline size_t bmp_row_bytes(const BmpInfo* info) {
+    return (size_t)info->Width * (info->BitCount / 8);
+}
+
+static inline size_t bmp_stride(const BmpInfo* info) {
+    return (bmp_row_bytes(info) + 3) & ~(size_t)3;
+}
+
+static inline size_t bmp_rows(const BmpInfo* info) {
+    return info->Height < 0 ? (size_t)-(long long)info->Height : (size_t)info->Height;
+}
 
 // pgm structure for header
 
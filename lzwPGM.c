@@ -2,156 +2,161 @@
 #include <stdlib.h>
 #include <string.h>
 #include "image.h"
+#include "lzwdict.h"
+#include "pgmstream.h"
 
-#define MAX_SIZE 256
 #define MAX_DICT_SIZE 4096 
-#define MAX_LINE 1024
 
-int compressLZW(const char* inputFile, const char* outputFile) {
-    FILE* input = fopen(inputFile, "rb");
-    FILE* output = fopen(outputFile, "wb");
-    if (!input || !output) {
-        printf("Cannot open the file");
+int compressLZW(const char* inputFile, const char* outputFile, const LZWOptions* opts) {
+    if (opts->mode < LZW_MODE_FIXED || opts->mode > LZW_MODE_STRIPS) {
+        printf("Unknown LZW mode\n");
         return 1;
     }
-
-    PGMHeader pgm;
-    char line[MAX_LINE];
-    if (!readLine(input, line, MAX_LINE) || sscanf(line, "%2s", pgm.sign) != 1) {
-        printf("Failed to read magic number\n");
-        fclose(input);
-        fclose(output);
+    if (opts->mode != LZW_MODE_FIXED &&
+        (opts->maxBits < LZW_MIN_BITS || opts->maxBits > LZW_MAX_BITS)) {
+        printf("Maximum code width must be between %d and %d bits\n", LZW_MIN_BITS, LZW_MAX_BITS);
         return 1;
     }
-    if (!readLine(input, line, MAX_LINE) || sscanf(line, "%d %d", &pgm.width, &pgm.height) != 2) {
-        printf("Failed to read dimensions\n");
-        fclose(input);
-        fclose(output);
+    if (opts->mode != LZW_MODE_FIXED &&
+        (opts->policy < LZW_POLICY_FREEZE || opts->policy > LZW_POLICY_LRU)) {
+        printf("Unknown dictionary policy\n");
         return 1;
     }
-    if (!readLine(input, line, MAX_LINE) || sscanf(line, "%d", &pgm.maxIntensity) != 1) {
-        printf("Failed to read maxval\n");
-        fclose(input);
-        fclose(output);
+
+    PGMReader reader;
+    if (openPGMReader(&reader, inputFile) != 0) {
         return 1;
     }
-    
-    if ((strcmp(pgm.sign, "P2") != 0 && strcmp(pgm.sign, "P5") != 0) || pgm.maxIntensity > 255) {
-        printf("Unsupported PGM format: %s, maxval: %d\n", pgm.sign, pgm.maxIntensity);
-        fclose(input);
-        fclose(output);
+    FILE* output = open_output_stream(outputFile);
+    if (!output) {
+        printf("Cannot open the file");
+        closePGMReader(&reader);
         return 1;
     }
+    PGMHeader pgm = reader.pgm;
+    long size = pgmFileSize(&reader);
 
-    long tP = (long)pgm.width * pgm.height; // totalPixels
-    unsigned char* iD = (unsigned char*)malloc(tP); // imageData
+    // Strips are coded in parallel from the whole image; every other
+    // layout is coded one batch of rows at a time as the rows are read.
+    long bR = opts->mode == LZW_MODE_STRIPS ? pgm.height : pgmBatchRows(&reader); // batchRows
+    unsigned char* iD = (unsigned char*)malloc(bR * pgm.width); // imageData
     if (!iD) {
         printf("Memory allocation failed\n");
-        fclose(input);
+        closePGMReader(&reader);
         fclose(output);
         return 1;
     }
 
-    if (strcmp(pgm.sign, "P2") == 0) {
-        for (long i = 0; i < tP; i++) {
-            int pixel;
-            if (fscanf(input, "%d", &pixel) != 1) {
-                printf("Error reading P2 data at pixel %ld\n", i);
-                free(iD);
-                fclose(input);
-                fclose(output);
-                return 1;
-            }
-            iD[i] = (unsigned char)pixel;
-        }
-    } else {
-        if (fread(iD, 1, tP, input) != tP) {
-            printf("Error reading P5 data\n");
-            free(iD);
-            fclose(input);
-            fclose(output);
-            return 1;
-        }
+    unsigned char version = LZW_VERSION;
+    unsigned char modeByte = (unsigned char)opts->mode;
+    int failed = fwrite(&pgm.width, sizeof(int), 1, output) != 1 ||
+                 fwrite(&pgm.height, sizeof(int), 1, output) != 1 ||
+                 fwrite(pgm.sign, sizeof(char), 2, output) != 2 ||
+                 fwrite(LZW_MAGIC, 1, LZW_MAGIC_BYTES, output) != LZW_MAGIC_BYTES ||
+                 fwrite(&version, 1, 1, output) != 1 ||
+                 fwrite(&modeByte, 1, 1, output) != 1;
+    if (!failed && opts->mode != LZW_MODE_FIXED) {
+        unsigned char maxBits = (unsigned char)opts->maxBits;
+        unsigned char policy = (unsigned char)opts->policy;
+        failed = fwrite(&maxBits, 1, 1, output) != 1 || fwrite(&policy, 1, 1, output) != 1;
     }
-    fseek(input, 0, SEEK_END);
-    long size = ftell(input);
-    fseek(input, sizeof(pgm), SEEK_SET);
-    fclose(input);
-
-    DictionaryEntry* dict = (DictionaryEntry*)malloc(MAX_DICT_SIZE * sizeof(DictionaryEntry));
-    int dictSize = MAX_SIZE;
-    for (int i = 0; i < MAX_SIZE; i++) {
-        dict[i].prefix = -1;
-        dict[i].value = (unsigned char)i;
-        dict[i].code = i;
+    if (!failed && opts->mode == LZW_MODE_STREAM) {
+        unsigned int batchRows = (unsigned int)bR;
+        failed = fwrite(&batchRows, sizeof(unsigned int), 1, output) != 1;
     }
 
-    fwrite(&pgm.width, sizeof(int), 1, output);
-    fwrite(&pgm.height, sizeof(int), 1, output);
-    fwrite(pgm.sign, sizeof(char), 2, output);
-
-    int code = iD[0];
-    int nextCode = MAX_SIZE;
-    unsigned int bitBuffer = 0;
-    int bits = 0;
-
-    for (long i = 1; i < tP; i++) {
-        unsigned char nextChar = iD[i];
-        int j;
-        for (j = 0; j < dictSize; j++) {
-            if (dict[j].prefix == code && dict[j].value == nextChar) {
-                code = dict[j].code;
-                break;
-            }
-        }
-        if (j == dictSize) { 
-            bitBuffer = (bitBuffer << 12) | code;
-            bits += 12;
-            while (bits >= 8) {
-                unsigned char byte = (bitBuffer >> (bits - 8)) & 0xFF;
-                fwrite(&byte, 1, 1, output);
-                bits -= 8;
-            }
-            bitBuffer &= (1 << bits) - 1; 
+    if (failed) {
+        printf("Failed to write header\n");
+        closePGMReader(&reader);
+        fclose(output);
+        free(iD);
+        return 1;
+    }
 
-            if (dictSize < MAX_DICT_SIZE) {
-                dict[dictSize].prefix = code;
-                dict[dictSize].value = nextChar;
-                dict[dictSize].code = nextCode++;
-                dictSize++;
+    const unsigned char* view;
+    if (opts->mode == LZW_MODE_STRIPS) {
+        failed = viewPGMRows(&reader, iD, bR, &view) != bR ||
+                 lzw_strips_encode(view, pgm.width, pgm.width, pgm.height, opts, output) != 0;
+    } else {
+        // The legacy layout is 12-bit codes with a 4096 entry dictionary
+        LZWOptions fixed = { LZW_MODE_FIXED, 12, LZW_POLICY_FREEZE };
+        LZWEncoder enc;
+        BitWriter bw;
+        if (lzw_encoder_init(&enc, opts->mode == LZW_MODE_FIXED ? &fixed : opts) != 0) {
+            failed = 1;
+        } else if (bit_writer_init(&bw, output) != 0) {
+            lzw_encoder_free(&enc);
+            failed = 1;
+        } else {
+            long rows;
+            startPGMReadAhead(&reader, bR);
+            while (!failed && (rows = viewPGMRows(&reader, iD, bR, &view)) > 0) {
+                if (opts->mode == LZW_MODE_STREAM) {
+                    failed = lzw_write_block(&enc, view, pgm.width, pgm.width, rows, &bw) != 0;
+                } else {
+                    lzw_encoder_feed(&enc, view, rows * pgm.width, &bw);
+                }
             }
-            code = nextChar;
+            if (rows < 0) failed = 1;
+            if (opts->mode != LZW_MODE_STREAM) lzw_encoder_finish(&enc, &bw);
+            failed |= bit_writer_flush(&bw) != 0;
+            bit_writer_free(&bw);
+            lzw_encoder_free(&enc);
         }
     }
-    bitBuffer = (bitBuffer << 12) | code;
-    bits += 12;
-    while (bits > 0) {
-        unsigned char byte = (bitBuffer >> (bits - 8)) & 0xFF;
-        fwrite(&byte, 1, 1, output);
-        bits -= 8;
-        if (bits < 0) break;
-    }
-
+    long compressedSize = stream_size(output);
+    closePGMReader(&reader);
     fclose(output);
     free(iD);
-    free(dict);
-
-    printf("Original size: %ld bytes\n", size);
-    
-    FILE *check_size = fopen("compressed.bin", "rb");
-    fseek(check_size, 0, SEEK_END);
-    long compressed_size = ftell(check_size);
-    fclose(check_size);
-    
-    printf("Compressed size: %ld bytes\n", compressed_size);
-    printf("Compression ratio: %.2f%%\n", 
-           (1.0 - ((float)compressed_size / size)) * 100); 
+    if (failed) {
+        printf("Failed to write compressed data\n");
+        return 1;
+    }
 
+    print_compression_report(size, compressedSize);
     return 0;
 }
 
+// Legacy layout: 12-bit codes, decoded as they are read in. Returns the
+// number of pixels written, or -1 if the stream could not be read at all.
+long decodeFixedLZW(FILE* input, unsigned char* dD, long tP) {
+    BitReader br;
+    if (bit_reader_open(&br, input) != 0) {
+        printf("Memory allocation failed\n");
+        return -1;
+    }
+
+    LZWDecoder dec;
+    if (lzw_decoder_init(&dec, MAX_DICT_SIZE, LZW_POLICY_FREEZE) != 0) {
+        printf("Memory allocation failed\n");
+        bit_reader_close(&br);
+        return -1;
+    }
+
+    long pW = 0; //pixelsWritten
+    while (pW < tP) {
+        if (br.count < 12) bit_reader_refill(&br);
+        int code = (int)bit_reader_peek(&br, 12);
+        bit_reader_skip(&br, 12);
+        if (bit_reader_overrun(&br)) {
+            printf("Unexpected end of file\n");
+            break;
+        }
+        long got = lzw_decoder_put(&dec, code, dD, pW, tP);
+        if (got < 0) {
+            printf("Invalid LZW code %d at pixel %ld\n", code, pW);
+            break;
+        }
+        pW += got;
+    }
+
+    lzw_decoder_free(&dec);
+    bit_reader_close(&br);
+    return pW;
+}
+
 int decompressLZW(const char* inputFile, const char* outputFile) {
-    FILE* input = fopen(inputFile, "rb");
+    FILE* input = open_input_stream(inputFile);
     if (!input) {
         printf("Cannot open input file: %s\n", inputFile);
         return 1;
@@ -162,149 +167,116 @@ int decompressLZW(const char* inputFile, const char* outputFile) {
         fread(&pgm.height, sizeof(int), 1, input) != 1 ||
         fread(pgm.sign, sizeof(char), 2, input) != 2) {
         printf("Failed to read header\n");
-        fclose(input);
+        close_stream(input);
         return 1;
     }
     pgm.sign[2] = '\0';
     pgm.maxIntensity = 255;
 
-    long tP = (long)pgm.width * pgm.height; // totalPixels
-    unsigned char* dD = (unsigned char*)malloc(tP); // decompressedData
-    if (!dD) {
-        printf("Memory allocation failed\n");
-        fclose(input);
+    // The first 12-bit code of an older stream is a pixel value, so its
+    // first byte is below 16 and can't be mistaken for the marker.
+    unsigned char marker[LZW_MAGIC_BYTES - 1], version;
+    unsigned char mode = LZW_MODE_FIXED, maxBits = 12, policy = LZW_POLICY_FREEZE;
+    int c = getc(input);
+    if (c < 16) {
+        if (c != EOF) ungetc(c, input);
+    } else if (c != LZW_MAGIC[0] ||
+        fread(marker, 1, sizeof(marker), input) != sizeof(marker) ||
+        memcmp(marker, LZW_MAGIC + 1, sizeof(marker)) != 0 ||
+        fread(&version, 1, 1, input) != 1 || version != LZW_VERSION ||
+        fread(&mode, 1, 1, input) != 1 ||
+        (mode != LZW_MODE_FIXED && (fread(&maxBits, 1, 1, input) != 1 ||
+                                    fread(&policy, 1, 1, input) != 1)) ||
+        mode > LZW_MODE_STRIPS ||
+        maxBits < LZW_MIN_BITS || maxBits > LZW_MAX_BITS || policy > LZW_POLICY_LRU) {
+        printf("Unknown LZW code format\n");
+        close_stream(input);
         return 1;
     }
 
-    DictionaryEntry* dict = (DictionaryEntry*)malloc(MAX_DICT_SIZE * sizeof(DictionaryEntry));
-    int dictSize = MAX_SIZE;
-    for (int i = 0; i < MAX_SIZE; i++) {
-        dict[i].prefix = -1;
-        dict[i].value = (unsigned char)i;
-        dict[i].code = i;
-    }
-
-    unsigned int bitBuffer = 0;
-    int bits = 0;
-    long pW = 0; //pixelsWritten
-    int next = MAX_SIZE;
-
-    unsigned char byte;
-    if (fread(&byte, 1, 1, input) != 1) {
-        printf("Failed to read initial byte\n");
-        free(dD);
-        free(dict);
-        fclose(input);
+    long tP = (long)pgm.width * pgm.height; // totalPixels
+    PGMOutput out;
+    if (openPGMOutput(&out, outputFile, &pgm) != 0) {
+        close_stream(input);
         return 1;
     }
-    bitBuffer = byte;
-    bits = 8;
-    if (fread(&byte, 1, 1, input) != 1) {
-        printf("Failed to read second byte\n");
-        free(dD);
-        free(dict);
-        fclose(input);
+    // Stream batches are decoded one after another into the output window;
+    // the other modes point back into, or decode in parallel over, the
+    // whole image
+    unsigned char* dD = NULL; // decompressedData
+    if (mode != LZW_MODE_STREAM && !(dD = pgmOutputPixels(&out, 0, tP))) {
+        printf("Memory allocation failed\n");
+        discardPGMOutput(&out);
+        close_stream(input);
         return 1;
     }
-    bitBuffer = (bitBuffer << 8) | byte;
-    bits += 8;
-
-    int code = (bitBuffer >> (bits - 12)) & 0xFFF;
-    bits -= 12;
-    dD[pW++] = (unsigned char)code;
-    int prev = code;
 
-    while (pW < tP) {
-        while (bits < 12) {
-            if (fread(&byte, 1, 1, input) != 1) {
-                printf("Unexpected end of file\n");
-                break;
+    long pW; // pixelsWritten
+    if (mode == LZW_MODE_STREAM) {
+        LZWDecoder dec;
+        unsigned int batchRows;
+        unsigned char* block = NULL;
+        size_t blockCap = 0;
+        pW = 0;
+        if (fread(&batchRows, sizeof(unsigned int), 1, input) == 1 && batchRows > 0 &&
+            lzw_decoder_init(&dec, 1 << maxBits, policy) == 0) {
+            long bP = (long)batchRows * pgm.width; // batchPixels
+            while (pW < tP) {
+                long n = tP - pW < bP ? tP - pW : bP;
+                dD = pgmOutputPixels(&out, pW, n);
+                if (!dD || lzw_read_block(&dec, input, &block, &blockCap, dD, n) != 0) break;
+                pW += n;
             }
-            bitBuffer = (bitBuffer << 8) | byte;
-            bits += 8;
-        }
-        code = (bitBuffer >> (bits - 12)) & 0xFFF;
-        bits -= 12;
-
-        unsigned char temp[MAX_SIZE];
-        int tempLen = 0;
-        int currentCode = code;
-
-        if (code >= dictSize) {
-            currentCode = prev;
-            temp[tempLen++] = dict[prev].value;
-        }
-
-        while (currentCode >= 0 && tempLen < MAX_SIZE) {
-            temp[tempLen++] = dict[currentCode].value;
-            currentCode = dict[currentCode].prefix;
+            lzw_decoder_free(&dec);
         }
-
-        for (int i = tempLen - 1; i >= 0 && pW < tP; i--) {
-            dD[pW++] = temp[i];
+        free(block);
+        close_stream(input);
+    } else if (mode == LZW_MODE_STRIPS) {
+        // The strip offsets only mean something once all of it is in
+        size_t cS; // compressedSize
+        unsigned char* cD = read_remaining(input, &cS); // compressedData
+        close_stream(input);
+        if (!cD) {
+            printf("Memory allocation failed\n");
+            discardPGMOutput(&out);
+            return 1;
         }
-
-        if (dictSize < MAX_DICT_SIZE) {
-            dict[dictSize].prefix = prev;
-            dict[dictSize].value = temp[tempLen - 1];
-            dict[dictSize].code = next++;
-            dictSize++;
+        LZWOptions opts = { mode, maxBits, policy };
+        pW = lzw_strips_decode(cD, cS, &opts, dD, pgm.width, pgm.height) == 0 ? tP : 0;
+        free(cD);
+    } else if (mode != LZW_MODE_FIXED) {
+        LZWOptions opts = { mode, maxBits, policy };
+        BitReader br;
+        if (bit_reader_open(&br, input) != 0) {
+            printf("Memory allocation failed\n");
+            discardPGMOutput(&out);
+            close_stream(input);
+            return 1;
         }
-        prev = code;
+        pW = lzw_decode_variable(&br, &opts, dD, tP);
+        bit_reader_close(&br);
+        close_stream(input);
+    } else {
+        pW = decodeFixedLZW(input, dD, tP);
+        close_stream(input);
     }
 
-    fclose(input);
-
     if (pW != tP) {
         printf("Error: Decompressed pixel count (%ld) doesn't match expected (%ld)\n",
                pW, tP);
-        free(dD);
-        free(dict);
-        return 1;
-    }
-
-    FILE* output = fopen(outputFile, "wb");
-    if (!output) {
-        printf("Cannot create output file: %s\n", outputFile);
-        free(dD);
-        free(dict);
+        discardPGMOutput(&out);
         return 1;
     }
 
-    fprintf(output, "%s\n%d %d\n%d\n", pgm.sign, pgm.width, pgm.height, pgm.maxIntensity);
-    if (strcmp(pgm.sign, "P2") == 0) {
-        for (long i = 0; i < tP; i++) {
-            if (fprintf(output, "%d", dD[i]) < 0) {
-                printf("Error writing P2 data\n");
-                fclose(output);
-                free(dD);
-                free(dict);
-                return 1;
-            }
-            if ((i + 1) % pgm.width == 0) fprintf(output, "\n");
-            else fprintf(output, " ");
-        }
-    } else {
-        if (fwrite(dD, 1, tP, output) != tP) {
-            printf("Error writing P5 data\n");
-            fclose(output);
-            free(dD);
-            free(dict);
-            return 1;
-        }
-    }
-
-    fclose(output);
-    free(dD);
-    free(dict);
-    return 0;
+    return closePGMOutput(&out);
 }
 
 int lzw() {
     char inputFile[256];
-    char compressedFile[256] = "compressed.bin";
+    char compressedFile[256];
     char decompressedFile[256];
     int yn;
+    LZWOptions opts;
 
     printf("What do you want to do??\n1.Compress an image.\n2.Decompress an image.\n");
     printf("Enter your choice in number: ");  
@@ -315,9 +287,18 @@ int lzw() {
         scanf("%255s", inputFile);
         printf("\n");
 
+        printf("Enter the compressed file name: ");
+        scanf("%255s", compressedFile);
+        printf("\n");
+
+        if (lzw_ask_options(&opts) != 0) {
+            printf("Invalid choice.\n");
+            return 0;
+        }
+
         printf("Attempting to compress %s...\n", inputFile);
         printf("\n");
-        if (compressLZW(inputFile, compressedFile) == 0) {
+        if (compressLZW(inputFile, compressedFile, &opts) == 0) {
             printf("Compression successful: %s -> %s\n", inputFile, compressedFile);
 
         } else {
@@ -325,6 +306,9 @@ int lzw() {
         }
     }
     else if(yn == 2){ 
+        printf("Enter the compressed file name: ");
+        scanf("%255s", compressedFile);
+        printf("\n");
         printf("Enter decompressed PGM file name: ");
         scanf("%255s", decompressedFile);
         printf("\n");
@@ -335,18 +319,10 @@ int lzw() {
         if (decompressLZW(compressedFile, decompressedFile) == 0) {
             printf("Decompression successful: %s -> %s\n", compressedFile, decompressedFile);
 
-            FILE* comp = fopen(compressedFile, "rb");
-            fseek(comp, 0, SEEK_END);
-            long compSize = ftell(comp);
-            fclose(comp);
-        
-            FILE* decomp = fopen(decompressedFile, "rb");
-            fseek(decomp, 0, SEEK_END);
-            long decompSize = ftell(decomp);
-            fclose(decomp);
-
-            printf("Compressed size: %ld bytes\n", compSize);
-            printf("Decompressed size: %ld bytes\n", decompSize);
+            long compSize = path_size(compressedFile);
+            long decompSize = path_size(decompressedFile);
+            if (compSize >= 0) printf("Compressed size: %ld bytes\n", compSize);
+            if (decompSize >= 0) printf("Decompressed size: %ld bytes\n", decompSize);
         } else {
             printf("Decompression failed\n");
         }
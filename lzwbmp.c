@@ -3,211 +3,315 @@
 #include <stdint.h>
 #include <string.h>
 #include "image.h"
+#include "lzwdict.h"
+#include "bmpsource.h"
+#include "bmpsink.h"
 
 #define MAX_DICT_SIZE 4096
-#define INITIAL_DICT_SIZE 256
-
-typedef struct {
-    unsigned short prefix;
-    unsigned char append;
-} DictionEn2;
-
-unsigned char* lzw_compress(unsigned char* input, unsigned int input_size, unsigned int* output_size) {
-    DictionEn2 dict[MAX_DICT_SIZE];
-    unsigned short dict_size = INITIAL_DICT_SIZE;
-    unsigned int i;
-
-    for (i = 0; i < INITIAL_DICT_SIZE; i++) {
-        dict[i].prefix = 0xFFFF;
-        dict[i].append = (uint8_t)i;
+// Legacy layout: 16-bit little-endian codes, read straight from the rows
+// of the mapped image.
+unsigned char* lzw_compress(const BmpSource* src, size_t* output_size) {
+    LZWDict dict;
+    if (lzw_dict_init(&dict, MAX_DICT_SIZE, LZW_ROOT_CODES) != 0) {
+        printf("Error: Memory allocation failed for compression\n");
+        return NULL;
     }
 
-    unsigned char* output = malloc(input_size * 2); 
+    unsigned char* output = malloc(bmp_source_size(src) * 2 + 2);
     if (!output) {
         printf("Error: Memory allocation failed for compression\n");
+        lzw_dict_free(&dict);
         return NULL;
     }
-    unsigned int out_pos = 0;
-    unsigned short prefix = input[0];
-    unsigned int in_pos = 1;
-
-    while (in_pos < input_size) {
-        unsigned char next_char = input[in_pos++];
-        unsigned short current = 0;
-
-        for (current = 0; current < dict_size; current++) {
-            if (dict[current].prefix == prefix && dict[current].append == next_char) {
-                prefix = current;
-                break;
+    size_t out_pos = 0;
+    int prefix = -1;
+
+    for (size_t y = 0; y < src->rows; y++) {
+        const unsigned char* row = bmp_source_row(src, y);
+        for (size_t i = 0; i < src->row_bytes; i++) {
+            unsigned char next_char = row[i];
+            if (prefix < 0) {
+                prefix = next_char;
+                continue;
             }
-        }
+            int current = lzw_dict_find(&dict, prefix, next_char);
 
-        if (current == dict_size) {
-            output[out_pos++] = prefix & 0xFF;
-            output[out_pos++] = (prefix >> 8) & 0xFF;
-            if (dict_size < MAX_DICT_SIZE) {
-                dict[dict_size].prefix = prefix;
-                dict[dict_size].append = next_char;
-                dict_size++;
+            if (current >= 0) {
+                prefix = current;
+            } else {
+                output[out_pos++] = prefix & 0xFF;
+                output[out_pos++] = (prefix >> 8) & 0xFF;
+                lzw_dict_add(&dict, prefix, next_char);
+                prefix = next_char;
             }
-            prefix = next_char;
         }
     }
 
-    output[out_pos++] = prefix & 0xFF;
-    output[out_pos++] = (prefix >> 8) & 0xFF;
+    if (prefix >= 0) {
+        output[out_pos++] = prefix & 0xFF;
+        output[out_pos++] = (prefix >> 8) & 0xFF;
+    }
 
+    lzw_dict_free(&dict);
     *output_size = out_pos;
     return output;
 }
 
-unsigned char* lzw_decompress(unsigned char* input, unsigned int input_size, unsigned int original_size) {
-    DictionEn2 dict[MAX_DICT_SIZE];
-    unsigned short dict_size = INITIAL_DICT_SIZE;
-    unsigned int i;
+// Decodes the legacy layout into original_size bytes of output, reading
+// the codes in as they are decoded. Returns 0, or -1 on corrupt data.
+int lzw_decompress(FILE* fin, unsigned char* output, size_t original_size) {
+    LZWDecoder dec;
+    if (lzw_decoder_init(&dec, MAX_DICT_SIZE, LZW_POLICY_FREEZE) != 0) {
+        printf("Error: Memory allocation failed for decompression\n");
+        return -1;
+    }
 
-    for (i = 0; i < INITIAL_DICT_SIZE; i++) {
-        dict[i].prefix = 0xFFFF;
-        dict[i].append = (unsigned char)i;
+    // 16-bit little-endian codes
+    unsigned char codes[1 << 14];
+    size_t input_size = 0;
+    size_t out_pos = 0;
+    size_t got;
+    int corrupt = 0;
+    while (!corrupt && out_pos < original_size && (got = fread(codes, 2, sizeof(codes) / 2, fin)) > 0) {
+        input_size += got * 2;
+        for (size_t i = 0; i < got && out_pos < original_size; i++) {
+            int code = codes[2 * i] | (codes[2 * i + 1] << 8);
+            long put = lzw_decoder_put(&dec, code, output, out_pos, original_size);
+            if (put < 0) {
+                corrupt = 1;
+                break;
+            }
+            out_pos += (size_t)put;
+        }
     }
+    lzw_decoder_free(&dec);
 
-    unsigned char* output = malloc(original_size);
-    if (!output) {
-        printf("Error: Memory allocation failed for decompression\n");
-        return NULL;
+    if (out_pos < original_size) {
+        printf("Error: Corrupt LZW data\n");
+        return -1;
     }
-    unsigned int out_pos = 0;
-    unsigned int in_pos = 0;
 
-    unsigned short old = input[in_pos++] | (input[in_pos++] << 8);
-    output[out_pos++] = (unsigned char)old;
+    printf("Decompressed %zu bytes to %zu bytes\n", input_size, original_size);
+    return 0;
+}
 
-    while (in_pos < input_size) {
-        unsigned short new = input[in_pos++] | (input[in_pos++] << 8);
-        unsigned char* temp = malloc(original_size);
-        unsigned int temp_pos = 0;
+// Streaming layout: rows are coded and written one batch at a time, each
+// batch as its own block, so memory use does not grow with the image. The
+// rows are coded in place from the mapped input.
+int lzw_stream_compress(const BmpSource* src, FILE* fout, const LZWOptions* opts) {
+    unsigned int batch_rows = lzw_batch_rows(src->row_bytes);
+    LZWEncoder enc;
+    BitWriter bw;
+    if (lzw_encoder_init(&enc, opts) != 0) {
+        printf("Error: Memory allocation failed\n");
+        return -1;
+    }
+    if (bit_writer_init(&bw, fout) != 0) {
+        printf("Error: Memory allocation failed\n");
+        lzw_encoder_free(&enc);
+        return -1;
+    }
 
-        if (new >= dict_size) {
-            temp[temp_pos++] = dict[old].append;
-            unsigned short temp_code = old;
-            while (temp_code != 0xFFFF) {
-                temp[temp_pos++] = dict[temp_code].append;
-                temp_code = dict[temp_code].prefix;
-            }
-        } else {
-            unsigned short temp_code = new;
-            while (temp_code != 0xFFFF) {
-                temp[temp_pos++] = dict[temp_code].append;
-                temp_code = dict[temp_code].prefix;
-            }
+    // While a batch is coded the next one is paged in from the input, and
+    // the blocks before it are written out on the writer thread
+    int failed = 0;
+    bit_writer_bytes(&bw, &batch_rows, sizeof(unsigned int));
+    for (size_t y = 0; y < src->rows && !failed; y += batch_rows) {
+        size_t count = src->rows - y < batch_rows ? src->rows - y : batch_rows;
+        if (y + count < src->rows) {
+            map_file_prefetch(&src->map, (size_t)(bmp_source_row(src, y + count) - src->map.data),
+                              (size_t)batch_rows * src->stride);
         }
-
-        for (i = temp_pos; i > 0; i--) {
-            output[out_pos++] = temp[i - 1];
+        if (lzw_write_block(&enc, bmp_source_row(src, y), src->row_bytes, src->stride, count, &bw) != 0) {
+            printf("Error: Failed to write compressed data\n");
+            failed = 1;
         }
+    }
+    if (!failed && bit_writer_flush(&bw) != 0) {
+        printf("Error: Failed to write compressed data\n");
+        failed = 1;
+    }
 
-        if (dict_size < MAX_DICT_SIZE) {
-            dict[dict_size].prefix = old;
-            dict[dict_size].append = temp[temp_pos - 1];
-            dict_size++;
+    bit_writer_free(&bw);
+    lzw_encoder_free(&enc);
+    return failed ? -1 : 0;
+}
+
+// Each batch is decoded packed into the output file at the place of its
+// first row, then spread out over its rows.
+int lzw_stream_decompress(FILE* fin, BmpSink* dst, const LZWOptions* opts) {
+    unsigned int batch_rows;
+    if (fread(&batch_rows, sizeof(unsigned int), 1, fin) != 1 || batch_rows == 0 ||
+        (size_t)batch_rows * dst->row_bytes > 4 * (size_t)LZW_BATCH_BYTES + dst->row_bytes) {
+        printf("Error: Invalid LZW block size\n");
+        return -1;
+    }
+
+    unsigned char* block = NULL;
+    size_t block_cap = 0;
+    LZWDecoder dec;
+    if (lzw_decoder_init(&dec, 1 << opts->maxBits, opts->policy) != 0) {
+        printf("Error: Memory allocation failed\n");
+        return -1;
+    }
+
+    int failed = 0;
+    for (size_t y = 0; y < dst->rows; y += batch_rows) {
+        size_t count = dst->rows - y < batch_rows ? dst->rows - y : batch_rows;
+        unsigned char* rows = bmp_sink_rows(dst, y, count);
+        if (!rows) {
+            printf("Error: Memory allocation failed\n");
+            failed = 1;
+            break;
+        }
+        if (lzw_read_block(&dec, fin, &block, &block_cap, rows, count * dst->row_bytes) != 0) {
+            printf("Error: Corrupt LZW data\n");
+            failed = 1;
+            break;
         }
-        old = new;
-        free(temp);
+        bmp_sink_spread_rows(dst, y, count);
     }
 
-    printf("Decompressed %u bytes to %u bytes\n", input_size, original_size);
-    return output;
+    lzw_decoder_free(&dec);
+    free(block);
+    return failed ? -1 : 0;
 }
 
-int compressBMP2(const char* input_file, const char* output_file) {
-    FILE* fin = fopen(input_file, "rb");
-    FILE* fout = fopen(output_file, "wb");
-    if (!fin || !fout) {
-        printf("Error: Cannot open input/output files\n");
+int compressBMP2(const char* input_file, const char* output_file, const LZWOptions* opts) {
+    if (opts->mode < LZW_MODE_FIXED || opts->mode > LZW_MODE_STRIPS) {
+        printf("Error: Unknown LZW mode\n");
+        return -1;
+    }
+    if (opts->mode != LZW_MODE_FIXED &&
+        (opts->maxBits < LZW_MIN_BITS || opts->maxBits > LZW_MAX_BITS)) {
+        printf("Error: Maximum code width must be between %d and %d bits\n", LZW_MIN_BITS, LZW_MAX_BITS);
+        return -1;
+    }
+    if (opts->mode != LZW_MODE_FIXED &&
+        (opts->policy < LZW_POLICY_FREEZE || opts->policy > LZW_POLICY_LRU)) {
+        printf("Error: Unknown dictionary policy\n");
         return -1;
     }
 
-    BmpFile file;
-    BmpInfo info;
-    if (fread(&file, sizeof(BmpFile), 1, fin) != 1 ||
-        fread(&info, sizeof(BmpInfo), 1, fin) != 1) {
-        printf("Error: Failed to read BMP headers\n");
-        fclose(fin);
+    BmpSource src;
+    if (bmp_source_open(&src, input_file) != 0) {
         return -1;
     }
+    BmpFile file = src.file;
+    BmpInfo info = src.info;
 
     if (info.Compression != 0) {
         printf("Error: Input BMP is already compressed\n");
-        fclose(fin);
+        bmp_source_close(&src);
+        return -1;
+    }
+
+    FILE* fout = open_output_stream(output_file);
+    if (!fout) {
+        printf("Error: Cannot open input/output files\n");
+        bmp_source_close(&src);
         return -1;
     }
 
     printf("Input BMP: %dx%d, %d bpp, size: %u bytes\n", info.Width, info.Height, info.BitCount, file.Size);
 
-    fseek(fin, file.Offbits, SEEK_SET);
-    unsigned int dS = info.Width * abs(info.Height) * (info.BitCount / 8); // Data size
-    unsigned char* pD = malloc(dS); // Pixel data
-    if (!pD) {
-        printf("Error: Memory allocation failed\n");
-        fclose(fin);
+    // Every mode codes the pixel rows in place from the mapped input
+    size_t dS = bmp_source_size(&src); // Data size
+    unsigned int stored_size = (unsigned int)dS; // low 32 bits, the decoder goes by the dimensions
+
+    unsigned char version = LZW_VERSION;
+    unsigned char mode_byte = (unsigned char)opts->mode;
+    unsigned char max_bits = (unsigned char)opts->maxBits;
+    unsigned char policy = (unsigned char)opts->policy;
+    info.Compression = 1; 
+
+    int failed = fwrite(&file, sizeof(BmpFile), 1, fout) != 1 ||
+                 fwrite(&info, sizeof(BmpInfo), 1, fout) != 1 ||
+                 fwrite(LZW_MAGIC, 1, LZW_MAGIC_BYTES, fout) != LZW_MAGIC_BYTES ||
+                 fwrite(&version, 1, 1, fout) != 1 ||
+                 fwrite(&stored_size, sizeof(unsigned int), 1, fout) != 1 ||
+                 fwrite(&mode_byte, 1, 1, fout) != 1;
+    if (!failed && opts->mode != LZW_MODE_FIXED) {
+        failed = fwrite(&max_bits, 1, 1, fout) != 1 || fwrite(&policy, 1, 1, fout) != 1;
+    }
+    if (failed) {
+        printf("Error: Failed to write header\n");
+        bmp_source_close(&src);
+        fclose(fout);
         return -1;
     }
-
-    int padding = (4 - (info.Width * (info.BitCount / 8)) % 4) % 4;
-    for (int i = 0; i < abs(info.Height); i++) {
-        if (fread(pD + (i * info.Width * (info.BitCount / 8)), info.Width * (info.BitCount / 8), 1, fin) != 1) {
-            printf("Error: Failed to read pixel data\n");
-            free(pD);
-            fclose(fin);
+    file.Offbits = ftell(fout);
+
+    if (opts->mode == LZW_MODE_VARIABLE) {
+        BitWriter bw;
+        failed = bit_writer_init(&bw, fout) != 0 ||
+                 lzw_encode_variable(src.pixels, src.row_bytes, src.stride, src.rows, opts, &bw) != 0 ||
+                 bit_writer_flush(&bw) != 0;
+        bit_writer_free(&bw);
+        if (failed) {
+            printf("Error: Failed to write compressed data\n");
+            bmp_source_close(&src);
+            fclose(fout);
+            return -1;
+        }
+    } else if (opts->mode == LZW_MODE_STRIPS) {
+        if (lzw_strips_encode(src.pixels, src.row_bytes, src.stride, src.rows, opts, fout) != 0) {
+            printf("Error: Failed to write compressed data\n");
+            bmp_source_close(&src);
+            fclose(fout);
+            return -1;
+        }
+    } else if (opts->mode == LZW_MODE_STREAM) {
+        if (lzw_stream_compress(&src, fout, opts) != 0) {
+            bmp_source_close(&src);
+            fclose(fout);
+            return -1;
+        }
+    } else {
+        size_t com_size;
+        unsigned char* compressed = lzw_compress(&src, &com_size);
+        if (!compressed) {
+            bmp_source_close(&src);
+            fclose(fout);
+            return -1;
+        }
+        failed = com_size > 0 && fwrite(compressed, com_size, 1, fout) != 1;
+        free(compressed);
+        if (failed) {
+            printf("Error: Failed to write compressed data\n");
+            bmp_source_close(&src);
+            fclose(fout);
             return -1;
         }
-        fseek(fin, padding, SEEK_CUR);
     }
 
-    unsigned int com_size;
-    unsigned char* compressed = lzw_compress(pD, dS, &com_size);
-    if (!compressed) {
-        free(pD);
-        fclose(fin);
-        return -1;
+    // The sizes go into the header afterwards, unless the output is a
+    // pipe, which the decoder does not mind
+    long compressed_size = stream_size(fout);
+    if (compressed_size >= 0 && fseek(fout, 0, SEEK_SET) == 0) {
+        unsigned int com_size = compressed_size - file.Offbits;
+        file.Size = file.Offbits + com_size;
+        info.SizeImage = com_size;
+        if (fwrite(&file, sizeof(BmpFile), 1, fout) != 1 || fwrite(&info, sizeof(BmpInfo), 1, fout) != 1) {
+            printf("Error: Failed to write header\n");
+            bmp_source_close(&src);
+            fclose(fout);
+            return -1;
+        }
     }
-
-    file.Offbits = sizeof(BmpFile) + sizeof(BmpInfo) + sizeof(unsigned int);
-    file.Size = file.Offbits + com_size;
-    info.Compression = 1; 
-    info.SizeImage = com_size;
-
-    fwrite(&file, sizeof(BmpFile), 1, fout);
-    fwrite(&info, sizeof(BmpInfo), 1, fout);
-    fwrite(&dS, sizeof(unsigned int), 1, fout); 
-    fwrite(compressed, com_size, 1, fout);
     printf("\n");
 
-    fseek(fin, 0, SEEK_END);
-    long size = ftell(fin);
-    fseek(fin, sizeof(BmpFile), SEEK_SET);
-
-    printf("Original size: %ld bytes\n", size);
-
-    FILE *check_size = fopen("compressed.bin", "rb");
-    fseek(check_size, 0, SEEK_END);
-    long compressed_size2 = ftell(check_size);
-    fclose(check_size);
-    
-    printf("Compressed size: %ld bytes\n", compressed_size2);
-    printf("Compression ratio: %.2f%%\n", (1.0 - ((float)compressed_size2 / size)) * 100); 
+    long size = is_std_stream(input_file) ? -1 : (long)src.map.size;
+    print_compression_report(size, compressed_size);
 
-    free(pD);
-    free(compressed);
-    fclose(fin);
+    bmp_source_close(&src);
     fclose(fout);
     return 0;
 }
 
 int decompressBMP2(const char* input_file, const char* output_file) {
-    FILE* fin = fopen(input_file, "rb");
-    FILE* fout = fopen(output_file, "wb");
-    if (!fin || !fout){
+    FILE* fin = open_input_stream(input_file);
+    if (!fin) {
         printf("Error: Cannot open input/output files\n");
         return -1;
     }
@@ -217,62 +321,127 @@ int decompressBMP2(const char* input_file, const char* output_file) {
     if (fread(&file, sizeof(BmpFile), 1, fin) != 1 ||
         fread(&info, sizeof(BmpInfo), 1, fin) != 1) {
         printf("Error: Failed to read BMP headers\n");
-        fclose(fin);
+        close_stream(fin);
         return -1;
     }
 
-    unsigned int og_size;
-    if (fread(&og_size, sizeof(unsigned int), 1, fin) != 1) {
+    // Without the marker the first word is already the size, followed
+    // straight away by fixed 16-bit codes.
+    unsigned char marker[LZW_MAGIC_BYTES];
+    unsigned char version = LZW_VERSION;
+    if (fread(marker, 1, LZW_MAGIC_BYTES, fin) != LZW_MAGIC_BYTES) {
         printf("Error: Failed to read original size\n");
-        fclose(fin);
+        close_stream(fin);
+        return -1;
+    }
+    int marked = memcmp(marker, LZW_MAGIC, LZW_MAGIC_BYTES) == 0;
+    if (marked && (fread(&version, 1, 1, fin) != 1 || version != LZW_VERSION)) {
+        printf("Error: Unsupported LZW format version\n");
+        close_stream(fin);
         return -1;
     }
 
-    unsigned char* compressed = malloc(info.SizeImage);
-    if (!compressed || fread(compressed, info.SizeImage, 1, fin) != 1) {
-        printf("Error: Failed to read compressed data\n");
-        free(compressed);
-        fclose(fin);
+    // The stored size only holds the low 32 bits; the full size comes
+    // from the dimensions
+    unsigned int stored_size;
+    size_t og_size = bmp_row_bytes(&info) * bmp_rows(&info);
+    if (!marked) {
+        memcpy(&stored_size, marker, sizeof(unsigned int));
+    } else if (fread(&stored_size, sizeof(unsigned int), 1, fin) != 1) {
+        printf("Error: Failed to read original size\n");
+        close_stream(fin);
+        return -1;
+    }
+    if (info.Width <= 0 || stored_size != (unsigned int)og_size) {
+        printf("Error: Invalid image size\n");
+        close_stream(fin);
         return -1;
     }
 
-    unsigned char* pD = lzw_decompress(compressed, info.SizeImage, og_size); // pixel data
-    if (!pD) {
-        free(compressed);
-        fclose(fin);
+    unsigned char mode = LZW_MODE_FIXED, max_bits = 16, policy = LZW_POLICY_FREEZE;
+    if (marked && (fread(&mode, 1, 1, fin) != 1 ||
+        (mode != LZW_MODE_FIXED && (fread(&max_bits, 1, 1, fin) != 1 ||
+                                    fread(&policy, 1, 1, fin) != 1)) ||
+        mode > LZW_MODE_STRIPS ||
+        max_bits < LZW_MIN_BITS || max_bits > LZW_MAX_BITS || policy > LZW_POLICY_LRU)) {
+        printf("Error: Unknown LZW code format\n");
+        close_stream(fin);
         return -1;
     }
 
     file.Offbits = sizeof(BmpFile) + sizeof(BmpInfo);
-    file.Size = file.Offbits + og_size + (abs(info.Height) * ((4 - (info.Width * 3) % 4) % 4));
+    file.Size = (unsigned int)(file.Offbits + bmp_stride(&info) * bmp_rows(&info));
     info.Compression = 0;
     info.SizeImage = 0;
-
-    fwrite(&file, sizeof(BmpFile), 1, fout);
-    fwrite(&info, sizeof(BmpInfo), 1, fout);
-
-    int padding = (4 - (info.Width * (info.BitCount / 8)) % 4) % 4;
-    int row_size = info.Width * (info.BitCount / 8);
-    unsigned char pad[4] = {0};
-
-    for (int i = 0; i < abs(info.Height); i++) {
-        fwrite(pD + (i * row_size), row_size, 1, fout);
-        fwrite(pad, padding, 1, fout);
+    LZWOptions opts = { mode, max_bits, policy };
+
+    // The compressed data runs to the end of the file; SizeImage is only
+    // 32 bits wide. Strips need all of it for their offsets; every other
+    // layout is read as it is decoded.
+    size_t com_size = 0;
+    unsigned char* compressed = NULL;
+    if (mode == LZW_MODE_STRIPS) {
+        compressed = read_remaining(fin, &com_size);
+        if (!compressed) {
+            printf("Error: Failed to read compressed data\n");
+            close_stream(fin);
+            return -1;
+        }
     }
 
+    // Pixels are decoded packed straight into the output file and then
+    // spread out over the rows
+    BmpSink dst;
+    if (bmp_sink_open(&dst, output_file, &file, &info) != 0) {
+        free(compressed);
+        close_stream(fin);
+        return -1;
+    }
+    // The stream batches go out to the file one after another; the other
+    // modes point back into, or decode in parallel over, the whole image
+    unsigned char* pD = NULL; // pixel data
+    if (mode != LZW_MODE_STREAM && !(pD = bmp_sink_rows(&dst, 0, dst.rows))) {
+        printf("Error: Memory allocation failed\n");
+        free(compressed);
+        close_stream(fin);
+        bmp_sink_discard(&dst);
+        return -1;
+    }
+    int failed;
+    if (mode == LZW_MODE_STREAM) {
+        failed = lzw_stream_decompress(fin, &dst, &opts) != 0;
+    } else if (mode == LZW_MODE_STRIPS) {
+        failed = lzw_strips_decode(compressed, com_size, &opts, pD, dst.row_bytes, dst.rows) != 0;
+        if (failed) printf("Error: Corrupt LZW data\n");
+    } else if (mode == LZW_MODE_VARIABLE) {
+        BitReader br;
+        failed = bit_reader_open(&br, fin) != 0 ||
+                 lzw_decode_variable(&br, &opts, pD, og_size) != (long)og_size;
+        bit_reader_close(&br);
+        if (failed) printf("Error: Corrupt LZW data\n");
+    } else {
+        failed = lzw_decompress(fin, pD, og_size) != 0;
+    }
     free(compressed);
-    free(pD);
-    fclose(fin);
-    fclose(fout);
+    close_stream(fin);
+    if (failed) {
+        bmp_sink_discard(&dst);
+        return -1;
+    }
+    if (mode != LZW_MODE_STREAM) bmp_sink_spread_rows(&dst, 0, dst.rows);
+    if (bmp_sink_close(&dst) != 0) {
+        return -1;
+    }
     printf("Decompressed file written to %s\n", output_file);
     return 0;
 }
 
 int lzwBMP() {
     char inputFile[256];
-    char compressedFile[256] = "compressed.bin";
+    char compressedFile[256];
     char decompressedFile[256];
     int yn;
+    LZWOptions opts;
 
     printf("What do you want to do??\n1.Compress an image.\n2.Decompress an image.\n");
     printf("Enter your choice in number: ");  
@@ -283,8 +452,17 @@ int lzwBMP() {
         scanf("%255s", inputFile);
         printf("\n");
 
+        printf("Enter the compressed file name: ");
+        scanf("%255s", compressedFile);
+        printf("\n");
+
+        if (lzw_ask_options(&opts) != 0) {
+            printf("Invalid choice.\n");
+            return 0;
+        }
+
         printf("Attempting to compress %s...\n", inputFile);
-        if (compressBMP2(inputFile, compressedFile) == 0) {
+        if (compressBMP2(inputFile, compressedFile, &opts) == 0) {
             printf("Compression successful: %s -> %s\n", inputFile, compressedFile);
 
         } else {
@@ -292,6 +470,9 @@ int lzwBMP() {
         }
     }
     else if(yn == 2){ 
+        printf("Enter the compressed file name: ");
+        scanf("%255s", compressedFile);
+        printf("\n");
         printf("Enter decompressed BMP file name: ");
         scanf("%255s", decompressedFile);
         printf("\n");
@@ -300,18 +481,10 @@ int lzwBMP() {
         if (decompressBMP2(compressedFile, decompressedFile) == 0) {
             printf("Decompression successful: %s -> %s\n", compressedFile, decompressedFile);
 
-            FILE* comp = fopen(compressedFile, "rb");
-            fseek(comp, 0, SEEK_END);
-            long compSize = ftell(comp);
-            fclose(comp);
-        
-            FILE* decomp = fopen(decompressedFile, "rb");
-            fseek(decomp, 0, SEEK_END);
-            long decompSize = ftell(decomp);
-            fclose(decomp);
-
-            printf("Compressed size: %ld bytes\n", compSize);
-            printf("Decompressed size: %ld bytes\n", decompSize);
+            long compSize = path_size(compressedFile);
+            long decompSize = path_size(decompressedFile);
+            if (compSize >= 0) printf("Compressed size: %ld bytes\n", compSize);
+            if (decompSize >= 0) printf("Decompressed size: %ld bytes\n", decompSize);
         } else {
             printf("Decompression failed\n");
         }
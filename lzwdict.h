@@ -0,0 +1,762 @@
+#ifndef LZWDICT_H
+#define LZWDICT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bitio.h"
+#include "parallel.h"
+
+#define LZW_ROOT_CODES 256
+#define LZW_MIN_BITS 9
+#define LZW_MAX_BITS 20
+#define LZW_CLEAR_CODE 256      // only reserved under LZW_POLICY_CLEAR
+#define LZW_CHECK_INTERVAL 8192 // input bytes between two ratio checks
+#define LZW_BATCH_BYTES (1 << 20) // input bytes per block in the streaming layout
+
+// Code layouts that can follow the fixed header of an LZW stream. The
+// header is followed by LZW_MAGIC, a version byte and the mode byte.
+// Streams without the marker predate it and hold LZW_MODE_FIXED codes:
+// the PGM ones start with a byte below 16, the BMP ones with the size word.
+#define LZW_MAGIC "LZW\xFF"
+#define LZW_MAGIC_BYTES 4
+#define LZW_VERSION 1
+#define LZW_MODE_FIXED 0    // 12-bit (PGM) or 16-bit (BMP) codes, 4096 entries
+#define LZW_MODE_VARIABLE 1 // 9-bit codes growing up to maxBits, then bytes of maxBits and policy
+#define LZW_MODE_STREAM 2   // variable-width codes in blocks of rows, each with a fresh dictionary
+#define LZW_MODE_STRIPS 3   // variable-width codes in strips of rows with an offset table, coded in parallel
+
+// What a variable-width stream does once its dictionary is full.
+#define LZW_POLICY_FREEZE 0 // keep using the dictionary as it is
+#define LZW_POLICY_CLEAR 1  // emit a clear code and start over when the ratio drops
+#define LZW_POLICY_LRU 2    // recycle the least recently used leaf entry
+
+typedef struct {
+    int mode;
+    int maxBits;
+    int policy;
+} LZWOptions;
+
+// LZW encoder dictionary shared by the PGM and BMP codecs. Each phrase is
+// a (prefix code, next byte) pair, looked up in an open-addressed hash
+// table with linear probing instead of scanning every entry. Codes are
+// handed out in order starting after the 256 single-byte roots, so the
+// emitted code sequence matches a plain array dictionary.
+typedef struct {
+    uint32_t* keys;    // (prefix << 8 | byte) + 1, 0 marks an empty slot
+    int* codes;
+    uint32_t* entries; // key of every code, so it can be found again
+    unsigned int mask;
+    int shift;
+    int first;         // first code handed out after a reset
+    int size;
+    int maxSize;
+} LZWDict;
+
+static inline uint32_t lzw_key(int prefix, unsigned char c) {
+    return (((uint32_t)prefix << 8) | c) + 1;
+}
+
+static inline unsigned int lzw_dict_slot(const LZWDict* d, uint32_t key) {
+    return (unsigned int)((key * 2654435761u) >> d->shift);
+}
+
+void lzw_dict_reset(LZWDict* d) {
+    memset(d->keys, 0, (size_t)(d->mask + 1) * sizeof(uint32_t));
+    d->size = d->first;
+}
+
+int lzw_dict_init(LZWDict* d, int maxSize, int first) {
+    unsigned int slots = 2;
+    int bits = 1;
+    while (slots < (unsigned int)maxSize * 2) {
+        slots <<= 1;
+        bits++;
+    }
+    d->keys = malloc(slots * sizeof(uint32_t));
+    d->codes = malloc(slots * sizeof(int));
+    d->entries = malloc(maxSize * sizeof(uint32_t));
+    if (!d->keys || !d->codes || !d->entries) {
+        free(d->keys);
+        free(d->codes);
+        free(d->entries);
+        return -1;
+    }
+    d->mask = slots - 1;
+    d->shift = 32 - bits;
+    d->first = first;
+    d->maxSize = maxSize;
+    lzw_dict_reset(d);
+    return 0;
+}
+
+void lzw_dict_free(LZWDict* d) {
+    free(d->keys);
+    free(d->codes);
+    free(d->entries);
+}
+
+// Returns the code for prefix followed by c, or -1 if it is not known yet.
+static inline int lzw_dict_find(const LZWDict* d, int prefix, unsigned char c) {
+    uint32_t key = lzw_key(prefix, c);
+    unsigned int slot = lzw_dict_slot(d, key);
+    while (d->keys[slot]) {
+        if (d->keys[slot] == key) return d->codes[slot];
+        slot = (slot + 1) & d->mask;
+    }
+    return -1;
+}
+
+static void lzw_dict_insert(LZWDict* d, uint32_t key, int code) {
+    unsigned int slot = lzw_dict_slot(d, key);
+    while (d->keys[slot]) {
+        slot = (slot + 1) & d->mask;
+    }
+    d->keys[slot] = key;
+    d->codes[slot] = code;
+    d->entries[code] = key;
+}
+
+// Adds prefix followed by c as the next code. Returns that code, or -1 if
+// the dictionary is full.
+int lzw_dict_add(LZWDict* d, int prefix, unsigned char c) {
+    if (d->size >= d->maxSize) return -1;
+    lzw_dict_insert(d, lzw_key(prefix, c), d->size);
+    return d->size++;
+}
+
+// Prefix code of an entry that is already in the dictionary.
+static inline int lzw_dict_prefix(const LZWDict* d, int code) {
+    return (int)((d->entries[code] - 1) >> 8);
+}
+
+// Gives an existing code a new phrase. The old key is taken out with
+// backward-shift deletion, so probe chains stay intact without tombstones.
+void lzw_dict_replace(LZWDict* d, int code, int prefix, unsigned char c) {
+    uint32_t old = d->entries[code];
+    unsigned int hole = lzw_dict_slot(d, old);
+    while (d->keys[hole] != old) {
+        hole = (hole + 1) & d->mask;
+    }
+    unsigned int j = hole;
+    for (;;) {
+        j = (j + 1) & d->mask;
+        if (!d->keys[j]) break;
+        unsigned int home = lzw_dict_slot(d, d->keys[j]);
+        if (((j - home) & d->mask) >= ((j - hole) & d->mask)) {
+            d->keys[hole] = d->keys[j];
+            d->codes[hole] = d->codes[j];
+            hole = j;
+        }
+    }
+    d->keys[hole] = 0;
+    lzw_dict_insert(d, lzw_key(prefix, c), code);
+}
+
+// Leaf entries (codes no other entry extends) in order of last use, most
+// recent first. Only leaves can be recycled without breaking a longer
+// string. The encoder and the decoder make the same calls in the same
+// order, so they always agree on the victim.
+typedef struct {
+    int* prev;
+    int* next;
+    int* children;
+    int head;
+    int tail;
+    int first;
+} LZWLru;
+
+int lzw_lru_init(LZWLru* l, int maxSize, int first) {
+    l->prev = malloc(maxSize * sizeof(int));
+    l->next = malloc(maxSize * sizeof(int));
+    l->children = calloc(maxSize, sizeof(int));
+    if (!l->prev || !l->next || !l->children) {
+        free(l->prev);
+        free(l->next);
+        free(l->children);
+        return -1;
+    }
+    l->head = l->tail = -1;
+    l->first = first;
+    return 0;
+}
+
+void lzw_lru_free(LZWLru* l) {
+    free(l->prev);
+    free(l->next);
+    free(l->children);
+}
+
+static void lzw_lru_unlink(LZWLru* l, int code) {
+    if (l->prev[code] >= 0) l->next[l->prev[code]] = l->next[code];
+    else l->head = l->next[code];
+    if (l->next[code] >= 0) l->prev[l->next[code]] = l->prev[code];
+    else l->tail = l->prev[code];
+}
+
+static void lzw_lru_push_head(LZWLru* l, int code) {
+    l->prev[code] = -1;
+    l->next[code] = l->head;
+    if (l->head >= 0) l->prev[l->head] = code;
+    else l->tail = code;
+    l->head = code;
+}
+
+static void lzw_lru_push_tail(LZWLru* l, int code) {
+    l->next[code] = -1;
+    l->prev[code] = l->tail;
+    if (l->tail >= 0) l->next[l->tail] = code;
+    else l->head = code;
+    l->tail = code;
+}
+
+void lzw_lru_touch(LZWLru* l, int code) {
+    if (code < l->first || l->children[code] || l->head == code) return;
+    lzw_lru_unlink(l, code);
+    lzw_lru_push_head(l, code);
+}
+
+// Coldest leaf other than exclude, or -1 if there is none.
+int lzw_lru_victim(const LZWLru* l, int exclude) {
+    int code = l->tail;
+    if (code >= 0 && code == exclude) code = l->prev[code];
+    return code;
+}
+
+void lzw_lru_added(LZWLru* l, int code, int prefix) {
+    l->children[code] = 0;
+    lzw_lru_push_head(l, code);
+    if (prefix >= l->first && l->children[prefix]++ == 0) lzw_lru_unlink(l, prefix);
+}
+
+// A prefix that loses its last child becomes the coldest leaf.
+void lzw_lru_removed(LZWLru* l, int code, int prefix) {
+    lzw_lru_unlink(l, code);
+    if (prefix >= l->first && --l->children[prefix] == 0) lzw_lru_push_tail(l, prefix);
+}
+
+static inline int lzw_first_code(int policy) {
+    return policy == LZW_POLICY_CLEAR ? LZW_CLEAR_CODE + 1 : LZW_ROOT_CODES;
+}
+
+// Asks for the code layout on the console, the way the codec menus do.
+int lzw_ask_options(LZWOptions* opts) {
+    int choice;
+    printf("Which LZW mode??\n1.Fixed-width codes.\n2.Variable-width codes.\n3.Streaming variable-width codes.\n4.Parallel variable-width strips.\n");
+    printf("Enter your choice in number: ");
+    scanf("%d", &choice);
+    printf("\n");
+    opts->mode = choice - 1;
+    opts->maxBits = 12;
+    opts->policy = LZW_POLICY_FREEZE;
+    if (opts->mode >= LZW_MODE_VARIABLE && opts->mode <= LZW_MODE_STRIPS) {
+        printf("Enter the maximum code width in bits (%d-%d): ", LZW_MIN_BITS, LZW_MAX_BITS);
+        scanf("%d", &opts->maxBits);
+        printf("\n");
+        if (opts->maxBits < LZW_MIN_BITS || opts->maxBits > LZW_MAX_BITS) return -1;
+
+        printf("Which dictionary policy??\n1.Freeze when full.\n2.Clear when the ratio drops.\n3.Replace least recently used entries.\n");
+        printf("Enter your choice in number: ");
+        scanf("%d", &choice);
+        printf("\n");
+        opts->policy = choice - 1;
+        if (opts->policy < LZW_POLICY_FREEZE || opts->policy > LZW_POLICY_LRU) return -1;
+    }
+    return opts->mode >= LZW_MODE_FIXED && opts->mode <= LZW_MODE_STRIPS ? 0 : -1;
+}
+
+// Smallest width that can carry maxCode, never below LZW_MIN_BITS.
+static inline int lzw_code_width(int maxCode) {
+    int bits = LZW_MIN_BITS;
+    while ((1 << bits) <= maxCode) bits++;
+    return bits;
+}
+
+// Variable-width LZW encoder. Every code is written with just enough bits
+// for the largest code the decoder can expect at that point, or with
+// maxBits bits each in the fixed layout. The input can be fed in any
+// number of pieces.
+typedef struct {
+    LZWDict dict;
+    LZWLru lru;
+    int policy;
+    int width;          // fixed code width, 0 for variable-width codes
+    int code;           // phrase being extended, -1 before the first byte
+    uint64_t inBytes;   // counted since the last clear code
+    uint64_t outBits;
+    uint64_t bestRatio;
+    uint64_t nextCheck;
+} LZWEncoder;
+
+int lzw_encoder_init(LZWEncoder* e, const LZWOptions* opts) {
+    int maxSize = 1 << opts->maxBits;
+    int first = lzw_first_code(opts->policy);
+    if (lzw_dict_init(&e->dict, maxSize, first) != 0) return -1;
+    if (opts->policy == LZW_POLICY_LRU && lzw_lru_init(&e->lru, maxSize, first) != 0) {
+        lzw_dict_free(&e->dict);
+        return -1;
+    }
+    e->policy = opts->policy;
+    e->width = opts->mode == LZW_MODE_FIXED ? opts->maxBits : 0;
+    e->code = -1;
+    e->inBytes = 0;
+    e->outBits = 0;
+    e->bestRatio = 0;
+    e->nextCheck = LZW_CHECK_INTERVAL;
+    return 0;
+}
+
+// Starts over with an empty dictionary, as if freshly initialised.
+void lzw_encoder_reset(LZWEncoder* e) {
+    lzw_dict_reset(&e->dict);
+    if (e->policy == LZW_POLICY_LRU) e->lru.head = e->lru.tail = -1;
+    e->code = -1;
+    e->inBytes = 0;
+    e->outBits = 0;
+    e->bestRatio = 0;
+    e->nextCheck = LZW_CHECK_INTERVAL;
+}
+
+void lzw_encoder_free(LZWEncoder* e) {
+    lzw_dict_free(&e->dict);
+    if (e->policy == LZW_POLICY_LRU) lzw_lru_free(&e->lru);
+}
+
+static inline void lzw_encoder_emit(LZWEncoder* e, int code, BitWriter* bw) {
+    int width = e->width ? e->width : lzw_code_width(e->dict.size - 1);
+    bit_writer_put(bw, (uint64_t)code, width);
+    e->outBits += width;
+}
+
+// The current phrase cannot be extended by c: emit it, learn phrase + c
+// and start a new phrase from c.
+static void lzw_encoder_step(LZWEncoder* e, unsigned char c, BitWriter* bw) {
+    lzw_encoder_emit(e, e->code, bw);
+    if (e->policy == LZW_POLICY_LRU) lzw_lru_touch(&e->lru, e->code);
+
+    if (e->dict.size < e->dict.maxSize) {
+        int added = lzw_dict_add(&e->dict, e->code, c);
+        if (e->policy == LZW_POLICY_LRU) lzw_lru_added(&e->lru, added, e->code);
+    } else if (e->policy == LZW_POLICY_LRU) {
+        int victim = lzw_lru_victim(&e->lru, e->code);
+        if (victim >= 0) {
+            lzw_lru_removed(&e->lru, victim, lzw_dict_prefix(&e->dict, victim));
+            lzw_dict_replace(&e->dict, victim, e->code, c);
+            lzw_lru_added(&e->lru, victim, e->code);
+        }
+    } else if (e->policy == LZW_POLICY_CLEAR && e->inBytes >= e->nextCheck) {
+        // Same rule as compress(1): keep the full dictionary while input
+        // bytes per output bit keep improving, clear it once they do not.
+        uint64_t ratio = (e->inBytes << 16) / (e->outBits ? e->outBits : 1);
+        if (ratio > e->bestRatio) {
+            e->bestRatio = ratio;
+            e->nextCheck = e->inBytes + LZW_CHECK_INTERVAL;
+        } else {
+            lzw_encoder_emit(e, LZW_CLEAR_CODE, bw);
+            lzw_dict_reset(&e->dict);
+            e->inBytes = 0;
+            e->outBits = 0;
+            e->bestRatio = 0;
+            e->nextCheck = LZW_CHECK_INTERVAL;
+        }
+    }
+    e->code = c;
+}
+
+void lzw_encoder_feed(LZWEncoder* e, const unsigned char* data, size_t n, BitWriter* bw) {
+    size_t i = 0;
+    if (e->code < 0 && n > 0) {
+        e->code = data[0];
+        e->inBytes++;
+        i = 1;
+    }
+    for (; i < n; i++) {
+        e->inBytes++;
+        int found = lzw_dict_find(&e->dict, e->code, data[i]);
+        if (found >= 0) {
+            e->code = found;
+        } else {
+            lzw_encoder_step(e, data[i], bw);
+        }
+    }
+}
+
+// Feeds rows of rowBytes bytes that start stride bytes apart, so padded
+// rows can be coded in place.
+void lzw_encoder_feed_rows(LZWEncoder* e, const unsigned char* data, size_t rowBytes, size_t stride,
+                           size_t rows, BitWriter* bw) {
+    for (size_t y = 0; y < rows; y++) {
+        lzw_encoder_feed(e, data + y * stride, rowBytes, bw);
+    }
+}
+
+// Emits the phrase still pending at the end of the input.
+void lzw_encoder_finish(LZWEncoder* e, BitWriter* bw) {
+    if (e->code >= 0) lzw_encoder_emit(e, e->code, bw);
+    e->code = -1;
+}
+
+int lzw_encode_variable(const unsigned char* input, size_t rowBytes, size_t stride, size_t rows,
+                        const LZWOptions* opts, BitWriter* bw) {
+    LZWEncoder enc;
+    if (lzw_encoder_init(&enc, opts) != 0) return -1;
+    lzw_encoder_feed_rows(&enc, input, rowBytes, stride, rows, bw);
+    lzw_encoder_finish(&enc, bw);
+    lzw_encoder_free(&enc);
+    return 0;
+}
+
+// Decoder side of the dictionary. Every code after the roots is stored as
+// the place where its string was last written in the output and its
+// length, so decoding a code is one forward copy out of the bytes already
+// produced: no per-code allocation, no prefix walk and no length cap. The
+// entry made after each code is simply the previous string plus one byte,
+// which is the byte that follows it in the output.
+typedef struct {
+    size_t* offset;
+    unsigned int* length;
+    int* prefix;   // only needed to keep the LRU leaf counts
+    LZWLru lru;
+    int policy;
+    int first;
+    int size;
+    int maxSize;
+    int prev;      // previous code, -1 at the start and after a clear code
+    size_t prevPos;
+    unsigned int prevLen;
+} LZWDecoder;
+
+int lzw_decoder_init(LZWDecoder* d, int maxSize, int policy) {
+    d->offset = malloc(maxSize * sizeof(size_t));
+    d->length = malloc(maxSize * sizeof(unsigned int));
+    d->prefix = malloc(maxSize * sizeof(int));
+    d->first = lzw_first_code(policy);
+    if (!d->offset || !d->length || !d->prefix ||
+        (policy == LZW_POLICY_LRU && lzw_lru_init(&d->lru, maxSize, d->first) != 0)) {
+        free(d->offset);
+        free(d->length);
+        free(d->prefix);
+        return -1;
+    }
+    d->policy = policy;
+    d->size = d->first;
+    d->maxSize = maxSize;
+    d->prev = -1;
+    return 0;
+}
+
+void lzw_decoder_reset(LZWDecoder* d) {
+    if (d->policy == LZW_POLICY_LRU) d->lru.head = d->lru.tail = -1;
+    d->size = d->first;
+    d->prev = -1;
+}
+
+void lzw_decoder_free(LZWDecoder* d) {
+    free(d->offset);
+    free(d->length);
+    free(d->prefix);
+    if (d->policy == LZW_POLICY_LRU) lzw_lru_free(&d->lru);
+}
+
+// Writes the string for code at out + pos, clipped to n, and adds the
+// dictionary entry the encoder created alongside it. Entries point back
+// into out, so every call for one stream must use the same buffer.
+// Returns the number of bytes written (0 for a clear code), or -1 for a
+// code that cannot occur at this point.
+long lzw_decoder_put(LZWDecoder* d, int code, unsigned char* out, size_t pos, size_t n) {
+    if (d->policy == LZW_POLICY_CLEAR && code == LZW_CLEAR_CODE) {
+        d->size = d->first;
+        d->prev = -1;
+        return 0;
+    }
+    if (pos >= n) return 0;
+    if (code < 0) return -1;
+
+    // Code the encoder gave to prev + the first byte of this string
+    int slot = -1;
+    if (d->prev >= 0) {
+        if (d->size < d->maxSize) slot = d->size;
+        else if (d->policy == LZW_POLICY_LRU) slot = lzw_lru_victim(&d->lru, d->prev);
+    }
+
+    size_t len;
+    if (code < LZW_ROOT_CODES) {
+        out[pos] = (unsigned char)code;
+        len = 1;
+    } else if (d->prev < 0) {
+        return -1;
+    } else if (code == slot) {
+        // The string is prev followed by its own first byte
+        len = (size_t)d->prevLen + 1;
+        size_t copy = len - 1 < n - pos ? len - 1 : n - pos;
+        memcpy(out + pos, out + d->prevPos, copy);
+        if (len <= n - pos) out[pos + len - 1] = out[d->prevPos];
+    } else if (code < d->size && code >= d->first) {
+        len = d->length[code];
+        memcpy(out + pos, out + d->offset[code], len < n - pos ? len : n - pos);
+    } else {
+        return -1;
+    }
+
+    if (slot >= 0) {
+        if (slot < d->size) lzw_lru_removed(&d->lru, slot, d->prefix[slot]);
+        else d->size++;
+        d->offset[slot] = d->prevPos;
+        d->length[slot] = d->prevLen + 1;
+        d->prefix[slot] = d->prev;
+        if (d->policy == LZW_POLICY_LRU) lzw_lru_added(&d->lru, slot, d->prev);
+    }
+    if (d->policy == LZW_POLICY_LRU) lzw_lru_touch(&d->lru, code);
+    d->prev = code;
+    d->prevPos = pos;
+    d->prevLen = (unsigned int)len;
+    return (long)(len < n - pos ? len : n - pos);
+}
+
+// Width of the next code in a variable-width stream as the decoder sees
+// it. The encoder is one entry ahead, so the next code can be as large as
+// the decoder's dictionary size.
+static inline int lzw_decoder_width(const LZWDecoder* d) {
+    if (d->prev < 0) return lzw_code_width(d->first - 1);
+    return lzw_code_width(d->size < d->maxSize ? d->size : d->maxSize - 1);
+}
+
+// Decodes codes from br into out until n bytes are produced or the stream
+// turns out to be corrupt. Returns the number of bytes produced.
+size_t lzw_decoder_run(LZWDecoder* d, BitReader* br, unsigned char* out, size_t n) {
+    size_t pos = 0;
+    while (pos < n) {
+        int width = lzw_decoder_width(d);
+        if (br->count < width) bit_reader_refill(br);
+        int code = (int)bit_reader_peek(br, width);
+        bit_reader_skip(br, width);
+        long got = lzw_decoder_put(d, code, out, pos, n);
+        if (got < 0 || bit_reader_overrun(br)) break;
+        pos += got;
+    }
+    return pos;
+}
+
+// Decodes a variable-width stream into out. Returns the number of bytes
+// produced, which is short of n on a corrupt stream, or -1 if the
+// dictionary could not be allocated.
+long lzw_decode_variable(BitReader* br, const LZWOptions* opts, unsigned char* out, size_t n) {
+    LZWDecoder dec;
+    if (lzw_decoder_init(&dec, 1 << opts->maxBits, opts->policy) != 0) return -1;
+    size_t pos = lzw_decoder_run(&dec, br, out, n);
+    lzw_decoder_free(&dec);
+    return (long)pos;
+}
+
+// Rows per block in the streaming layout, at least one.
+static inline unsigned int lzw_batch_rows(size_t rowBytes) {
+    size_t rows = rowBytes ? LZW_BATCH_BYTES / rowBytes : 1;
+    return rows ? (unsigned int)rows : 1;
+}
+
+// Streaming layout block: a 32-bit byte count, then the codes for one
+// batch of rows starting from an empty dictionary, padded to a whole byte.
+// The block is coded into memory first so its count can go out ahead of
+// it, which keeps bw writing straight through without seeking back. Rows
+// are laid out as for lzw_encoder_feed_rows.
+int lzw_write_block(LZWEncoder* e, const unsigned char* data, size_t rowBytes, size_t stride,
+                    size_t rows, BitWriter* bw) {
+    BitWriter block;
+    if (bit_writer_init(&block, NULL) != 0) return -1;
+    lzw_encoder_reset(e);
+    lzw_encoder_feed_rows(e, data, rowBytes, stride, rows, &block);
+    lzw_encoder_finish(e, &block);
+    int failed = bit_writer_flush(&block) != 0 || block.pos > 0xFFFFFFFFu;
+    if (!failed) {
+        unsigned int len = (unsigned int)block.pos;
+        bit_writer_bytes(bw, &len, sizeof(len));
+        bit_writer_bytes(bw, block.buffer, block.pos);
+        failed = bw->error;
+    }
+    bit_writer_free(&block);
+    return failed ? -1 : 0;
+}
+
+// Reads one block into *buf, growing it as needed, and decodes exactly n
+// bytes from it. Returns 0, or -1 on a short read or a corrupt block.
+int lzw_read_block(LZWDecoder* d, FILE* file, unsigned char** buf, size_t* cap,
+                   unsigned char* out, size_t n) {
+    unsigned int len;
+    if (fread(&len, sizeof(len), 1, file) != 1) return -1;
+    if (len > *cap) {
+        unsigned char* grown = realloc(*buf, len);
+        if (!grown) return -1;
+        *buf = grown;
+        *cap = len;
+    }
+    if (fread(*buf, 1, len, file) != len) return -1;
+
+    BitReader br;
+    bit_reader_init(&br, *buf, len);
+    lzw_decoder_reset(d);
+    return lzw_decoder_run(d, &br, out, n) == n ? 0 : -1;
+}
+
+// Strip layout: rows per strip, strip count, then count + 1 byte offsets
+// of the strips (relative to the first one) and the strips themselves.
+// Every strip starts from an empty dictionary, so strips are coded on a
+// thread pool and the output is the same for any number of threads.
+typedef struct {
+    const LZWOptions* opts;
+    const unsigned char* in;
+    unsigned char* out;
+    size_t stripBytes;
+    size_t total;
+    size_t rowBytes;          // input rows when encoding
+    size_t stride;
+    size_t stripRows;
+    size_t rows;
+    unsigned char** blocks;   // encoded strips
+    size_t* sizes;
+    const uint64_t* offsets;  // strip boundaries in the input when decoding
+    int* failed;
+} LZWStripJob;
+
+static void lzw_strip_encode_task(void* ctx, int i) {
+    LZWStripJob* job = (LZWStripJob*)ctx;
+    size_t first = (size_t)i * job->stripRows;
+    size_t n = job->rows - first < job->stripRows ? job->rows - first : job->stripRows;
+
+    BitWriter bw;
+    LZWEncoder enc;
+    if (bit_writer_init(&bw, NULL) != 0) {
+        job->failed[i] = 1;
+        return;
+    }
+    if (lzw_encoder_init(&enc, job->opts) != 0) {
+        bit_writer_free(&bw);
+        job->failed[i] = 1;
+        return;
+    }
+    lzw_encoder_feed_rows(&enc, job->in + first * job->stride, job->rowBytes, job->stride, n, &bw);
+    lzw_encoder_finish(&enc, &bw);
+    job->failed[i] = bit_writer_flush(&bw) != 0;
+    job->blocks[i] = bw.buffer;
+    job->sizes[i] = bw.pos;
+    lzw_encoder_free(&enc);
+}
+
+static void lzw_strip_decode_task(void* ctx, int i) {
+    LZWStripJob* job = (LZWStripJob*)ctx;
+    size_t start = (size_t)i * job->stripBytes;
+    size_t n = job->total - start < job->stripBytes ? job->total - start : job->stripBytes;
+
+    LZWDecoder dec;
+    if (lzw_decoder_init(&dec, 1 << job->opts->maxBits, job->opts->policy) != 0) {
+        job->failed[i] = 1;
+        return;
+    }
+    BitReader br;
+    bit_reader_init(&br, job->in + job->offsets[i], (size_t)(job->offsets[i + 1] - job->offsets[i]));
+    job->failed[i] = lzw_decoder_run(&dec, &br, job->out + start, n) != n;
+    lzw_decoder_free(&dec);
+}
+
+// Encodes rows x rowBytes bytes of data, rows stride bytes apart, in the
+// strip layout. Returns 0, or -1 if memory ran out or the file could not be
+// written.
+int lzw_strips_encode(const unsigned char* data, size_t rowBytes, size_t stride, size_t rows,
+                      const LZWOptions* opts, FILE* file) {
+    uint32_t stripRows = lzw_batch_rows(rowBytes);
+    uint32_t count = (uint32_t)((rows + stripRows - 1) / stripRows);
+    LZWStripJob job;
+    job.opts = opts;
+    job.in = data;
+    job.out = NULL;
+    job.stripBytes = (size_t)stripRows * rowBytes;
+    job.total = rows * rowBytes;
+    job.rowBytes = rowBytes;
+    job.stride = stride;
+    job.stripRows = stripRows;
+    job.rows = rows;
+    job.blocks = calloc(count + 1, sizeof(unsigned char*));
+    job.sizes = calloc(count + 1, sizeof(size_t));
+    job.failed = calloc(count + 1, sizeof(int));
+    uint64_t* offsets = malloc((count + 1) * sizeof(uint64_t));
+    job.offsets = offsets;
+
+    int failed = !job.blocks || !job.sizes || !job.failed || !offsets;
+    if (!failed) {
+        parallel_for((int)count, lzw_strip_encode_task, &job);
+        offsets[0] = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            failed |= job.failed[i];
+            offsets[i + 1] = offsets[i] + job.sizes[i];
+        }
+    }
+    if (!failed) {
+        failed = fwrite(&stripRows, sizeof(stripRows), 1, file) != 1 ||
+                 fwrite(&count, sizeof(count), 1, file) != 1 ||
+                 fwrite(offsets, sizeof(uint64_t), count + 1, file) != count + 1;
+        for (uint32_t i = 0; i < count && !failed; i++) {
+            failed = fwrite(job.blocks[i], 1, job.sizes[i], file) != job.sizes[i];
+        }
+    }
+
+    for (uint32_t i = 0; job.blocks && i < count; i++) {
+        free(job.blocks[i]);
+    }
+    free(job.blocks);
+    free(job.sizes);
+    free(job.failed);
+    free(offsets);
+    return failed ? -1 : 0;
+}
+
+// Decodes a strip layout held in memory into rows x rowBytes bytes of out.
+// Returns 0, or -1 on a corrupt stream or when memory ran out.
+int lzw_strips_decode(const unsigned char* in, size_t size, const LZWOptions* opts,
+                      unsigned char* out, size_t rowBytes, size_t rows) {
+    uint32_t stripRows, count;
+    if (size < 2 * sizeof(uint32_t)) return -1;
+    memcpy(&stripRows, in, sizeof(uint32_t));
+    memcpy(&count, in + sizeof(uint32_t), sizeof(uint32_t));
+    if (stripRows == 0 || count != (rows + stripRows - 1) / stripRows) return -1;
+
+    size_t table = 2 * sizeof(uint32_t) + ((size_t)count + 1) * sizeof(uint64_t);
+    if (size < table) return -1;
+    uint64_t* offsets = malloc(((size_t)count + 1) * sizeof(uint64_t));
+    int* failed = calloc((size_t)count + 1, sizeof(int));
+    if (!offsets || !failed) {
+        free(offsets);
+        free(failed);
+        return -1;
+    }
+    memcpy(offsets, in + 2 * sizeof(uint32_t), ((size_t)count + 1) * sizeof(uint64_t));
+    int bad = offsets[0] != 0;
+    for (uint32_t i = 0; i < count && !bad; i++) {
+        bad = offsets[i + 1] < offsets[i];
+    }
+    if (bad || offsets[count] > size - table) {
+        free(offsets);
+        free(failed);
+        return -1;
+    }
+
+    LZWStripJob job;
+    job.opts = opts;
+    job.in = in + table;
+    job.out = out;
+    job.stripBytes = (size_t)stripRows * rowBytes;
+    job.total = rows * rowBytes;
+    job.blocks = NULL;
+    job.sizes = NULL;
+    job.offsets = offsets;
+    job.failed = failed;
+    parallel_for((int)count, lzw_strip_decode_task, &job);
+
+    for (uint32_t i = 0; i < count; i++) {
+        bad |= failed[i];
+    }
+    free(offsets);
+    free(failed);
+    return bad ? -1 : 0;
+}
+
+#endif
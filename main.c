@@ -1,7 +1,60 @@
+// The codecs are all compiled into this file through compression.h, so the
+// POSIX calls they use have to be asked for ahead of the first system header.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
+#include <stdlib.h>
 #include "compression.h"
 
-int main(void){
+// Command-line mode, for scripts and shell pipelines. The arguments are the
+// answers the menus ask for, with the file names in between:
+//   TYPE ALGORITHM ACTION INPUT OUTPUT [MODE [MAXBITS POLICY]]
+// e.g. "1 3 1 in.pgm out.bin 2 12 1" compresses a PGM image with
+// variable-width LZW. For Huffman, MAXBITS is the longest code allowed
+// (default HUFF_MAX_LIMIT) and POLICY is not used. "-" as INPUT or OUTPUT
+// reads standard input or writes standard output; messages then go to
+// stderr.
+int runCommand(int argc, char** argv) {
+    if (argc < 6) {
+        fprintf(stderr, "Usage: %s TYPE ALGORITHM ACTION INPUT OUTPUT [MODE [MAXBITS POLICY]]\n", argv[0]);
+        fprintf(stderr, "MAXBITS is the LZW code width, or for Huffman the longest code (default %d)\n",
+                HUFF_MAX_LIMIT);
+        return 2;
+    }
+    int type = atoi(argv[1]), algorithm = atoi(argv[2]), action = atoi(argv[3]);
+    const char* input = argv[4];
+    const char* output = argv[5];
+    int mode = argc > 6 ? atoi(argv[6]) : 1;
+    LZWOptions opts = { mode - 1, argc > 7 ? atoi(argv[7]) : 12, argc > 8 ? atoi(argv[8]) - 1 : LZW_POLICY_FREEZE };
+    int maxLength = argc > 7 ? atoi(argv[7]) : HUFF_MAX_LIMIT;
+    if (is_std_stream(output)) close(claim_stdout()); // before anything is printed
+
+    int result = -1;
+    if ((action != 1 && action != 2) || (action == 1 && algorithm == 1 && (mode < 1 || mode > 7))) {
+        printf("Invalid choice.\n");
+    } else if (type == 1 && algorithm == 1) {
+        result = action == 1 ? compressHuffman(input, output, mode - 1, maxLength) : decompressHuffman(input, output);
+    } else if (type == 1 && algorithm == 2) {
+        result = action == 1 ? compressRLE(input, output) : decompressRLE(input, output);
+    } else if (type == 1 && algorithm == 3) {
+        result = action == 1 ? compressLZW(input, output, &opts) : decompressLZW(input, output);
+    } else if (type == 2 && algorithm == 1) {
+        result = action == 1 ? compressBMP3(input, output, mode - 1, maxLength) : decompressBMP3(input, output);
+    } else if (type == 2 && algorithm == 2) {
+        result = action == 1 ? compressBMP(input, output) : decompressBMP(input, output);
+    } else if (type == 2 && algorithm == 3) {
+        result = action == 1 ? compressBMP2(input, output, &opts) : decompressBMP2(input, output);
+    } else {
+        printf("Invalid choice.\n");
+    }
+    return result == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv){
+    if (argc > 1) {
+        return runCommand(argc, argv);
+    }
     int choice1, choice2;
     printf("Welcome to the Image Compression Tool\n");
     printf("This tool is used to compress the image using different algorithms.\n");
@@ -0,0 +1,206 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+// mmap, madvise, posix_fallocate and fdopen are POSIX, not ISO C; ask for
+// them before any system header is read.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bitio.h"
+#include "pipeline.h"
+#include "stdstream.h"
+
+// Read-only view of a whole input file. The file is mapped with a
+// sequential access hint so codecs read pixels straight from the page
+// cache with no stdio copy and no seeks. Anything that cannot be mapped
+// (an empty file, a pipe, standard input) is read into the heap instead,
+// from where the stream is now.
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    int mapped; // data is an mmap of the file, else a heap copy
+} MappedFile;
+
+int map_file(MappedFile* m, FILE* file) {
+    struct stat st;
+    m->data = NULL;
+    m->size = 0;
+    m->mapped = 0;
+    if (file != stdin && fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        if (p != MAP_FAILED) {
+            madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+            m->data = (const unsigned char*)p;
+            m->size = (size_t)st.st_size;
+            m->mapped = 1;
+            return 0;
+        }
+    }
+    m->data = read_remaining(file, &m->size);
+    return m->data ? 0 : -1;
+}
+
+// Opens and maps a file by name, or reads all of standard input for "-".
+// Returns -1 if it cannot be opened or read.
+int map_file_open(MappedFile* m, const char* path) {
+    FILE* file = open_input_stream(path);
+    if (!file) return -1;
+    int result = map_file(m, file);
+    close_stream(file);
+    return result;
+}
+
+// Asks for a range of a mapped file to be read in the background, so the
+// pages are in memory by the time the codec gets to them. Ranges past the
+// end are clipped; a heap copy is already in memory.
+void map_file_prefetch(const MappedFile* m, size_t offset, size_t length) {
+    if (!m->mapped || offset >= m->size) return;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = offset / page * page;
+    size_t end = offset + length < m->size ? offset + length : m->size;
+    madvise((void*)(m->data + start), end - start, MADV_WILLNEED);
+}
+
+void unmap_file(MappedFile* m) {
+    if (m->mapped) munmap((void*)m->data, m->size);
+    else free((void*)m->data);
+    m->data = NULL;
+    m->size = 0;
+}
+
+// Output file of a size known up front. The file is preallocated, so the
+// disk space is claimed before decoding starts, and mapped, so decoders
+// write straight into it. Anything that cannot be mapped (a pipe, a
+// terminal, standard output) gets a zeroed window of MAP_SINK_WINDOW bytes
+// instead, or more if a decoder asks for a bigger range at once. Decoders
+// ask for the ranges they write with map_sink_reserve in file order, and
+// what lies before a range is passed on to a writer thread once the window
+// has to move past it. Either way the contents start out zeroed.
+#define MAP_SINK_WINDOW (1 << 20) // bytes kept of an unmapped sink
+#define MAP_SINK_SLOT (1 << 18)   // bytes per buffer handed to the writer
+
+typedef struct {
+    unsigned char* data; // the whole file, or the window from base on
+    size_t size;
+    size_t base;     // file offset of data[0]
+    size_t capacity; // bytes in data
+    int fd;
+    int mapped;
+    FILE* file; // unmapped output, written by writer
+    PipeWriter writer;
+} MappedSink;
+
+int map_sink_open(MappedSink* s, const char* path, size_t size) {
+    struct stat st;
+    s->data = NULL;
+    s->size = size;
+    s->base = 0;
+    s->capacity = size;
+    s->mapped = 0;
+    int std = is_std_stream(path);
+    s->fd = std ? claim_stdout() : open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (s->fd < 0) return -1;
+
+    if (!std && fstat(s->fd, &st) == 0 && S_ISREG(st.st_mode) && size > 0) {
+        if (posix_fallocate(s->fd, 0, (off_t)size) != 0 && ftruncate(s->fd, (off_t)size) != 0) {
+            close(s->fd);
+            return -1;
+        }
+        void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, size, MADV_SEQUENTIAL);
+            s->data = (unsigned char*)p;
+            s->mapped = 1;
+            return 0;
+        }
+    }
+    if (s->capacity > MAP_SINK_WINDOW) s->capacity = MAP_SINK_WINDOW;
+    s->data = (unsigned char*)calloc(s->capacity ? s->capacity : 1, 1);
+    s->file = s->data ? fdopen(s->fd, "wb") : NULL;
+    if (!s->file || pipe_writer_start(&s->writer, s->file, MAP_SINK_SLOT) != 0) {
+        free(s->data);
+        if (s->file) fclose(s->file);
+        else close(s->fd);
+        return -1;
+    }
+    return 0;
+}
+
+// Hands bytes base .. end - 1 of an unmapped sink to the writer. Bytes past
+// the window were never asked for and go out as zeros. A write error is
+// kept by the writer and reported on close.
+static void map_sink_flush(MappedSink* s, size_t end) {
+    for (size_t at = 0; at < end - s->base;) {
+        unsigned char* slot = pipe_queue_reserve(&s->writer.queue);
+        size_t n = end - s->base - at < MAP_SINK_SLOT ? end - s->base - at : MAP_SINK_SLOT;
+        size_t held = at < s->capacity ? s->capacity - at : 0;
+        if (held > n) held = n;
+        memcpy(slot, s->data + at, held);
+        memset(slot + held, 0, n - held);
+        pipe_queue_publish(&s->writer.queue, (long)n);
+        at += n;
+    }
+}
+
+// Returns where bytes offset .. offset + length - 1 of the file go. Asking
+// for offset says everything before it is final, so offsets must not go
+// back. The window grows to the longest range asked for, so a range no
+// longer than MAP_SINK_WINDOW or than one asked for before always fits;
+// NULL means a longer one ran out of memory.
+unsigned char* map_sink_reserve(MappedSink* s, size_t offset, size_t length) {
+    if (s->mapped || offset + length <= s->base + s->capacity) return s->data + (offset - s->base);
+    // Grow first so that running out of memory leaves the window as it was
+    if (length > s->capacity) {
+        unsigned char* grown = (unsigned char*)realloc(s->data, length);
+        if (!grown) return NULL;
+        memset(grown + s->capacity, 0, length - s->capacity);
+        s->data = grown;
+        s->capacity = length;
+    }
+    size_t keep = offset < s->base + s->capacity ? s->base + s->capacity - offset : 0;
+    map_sink_flush(s, offset);
+    memmove(s->data, s->data + (offset - s->base), keep);
+    memset(s->data + keep, 0, s->capacity - keep);
+    s->base = offset;
+    return s->data;
+}
+
+// Finishes the file. Returns -1 if it could not be written out.
+int map_sink_close(MappedSink* s) {
+    int failed = 0;
+    if (s->mapped) {
+        failed = munmap(s->data, s->size) != 0;
+        failed |= close(s->fd) != 0;
+    } else {
+        map_sink_flush(s, s->size);
+        failed = pipe_writer_finish(&s->writer) != 0;
+        free(s->data);
+        failed |= fclose(s->file) != 0;
+    }
+    s->data = NULL;
+    return failed ? -1 : 0;
+}
+
+// Stops after a failed decode. What is left of an unmapped sink is dropped
+// rather than written out.
+void map_sink_abort(MappedSink* s) {
+    if (s->mapped) {
+        munmap(s->data, s->size);
+        close(s->fd);
+    } else {
+        pipe_writer_finish(&s->writer);
+        free(s->data);
+        fclose(s->file);
+    }
+    s->data = NULL;
+}
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef P2PARSE_H
+#define P2PARSE_H
+
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "histogram.h"
+#include "parallel.h"
+
+#define P2_PARALLEL_BYTES (1 << 20) // smallest text worth splitting across threads
+#define P2_MAX_SEGMENTS 64
+
+// ASCII PGM pixel parser working on text already in memory, replacing one
+// fscanf call per pixel. Whitespace is skipped 16 bytes at a time using a
+// vector digit/space classification, and large texts are cut into
+// segments at whitespace and parsed on the thread pool.
+
+static inline int isP2Space(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline int isP2Digit(unsigned char c) {
+    return (unsigned char)(c - '0') < 10;
+}
+
+#ifdef __SSE2__
+// Bit i of digits / spaces is set when p[i] is a digit / whitespace.
+static inline void classifyP2Block(const unsigned char* p, unsigned int* digits, unsigned int* spaces) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i isControl = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8('\r' - '\t')), t);
+    __m128i isSpace = _mm_or_si128(isControl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    *digits = (unsigned int)_mm_movemask_epi8(isDigit);
+    *spaces = (unsigned int)_mm_movemask_epi8(isSpace);
+}
+#endif
+
+// Counts the numbers in text[0, len). Returns -1 on a character that is
+// neither a digit nor whitespace.
+long countP2Values(const unsigned char* text, size_t len) {
+    long count = 0;
+    unsigned int prevDigit = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        unsigned int digits, spaces;
+        classifyP2Block(text + i, &digits, &spaces);
+        if ((digits | spaces) != 0xFFFF) return -1;
+        count += __builtin_popcount(digits & ~((digits << 1) | prevDigit));
+        prevDigit = (digits >> 15) & 1;
+    }
+#endif
+    for (; i < len; i++) {
+        unsigned int digit = isP2Digit(text[i]);
+        if (!digit && !isP2Space(text[i])) return -1;
+        count += digit && !prevDigit;
+        prevDigit = digit;
+    }
+    return count;
+}
+
+// Parses up to maxValues numbers from text[0, len) into out and counts
+// them in hist when it is not NULL. The text must not end in the middle of
+// a number. Returns the number of bytes consumed, up to just past the last
+// number parsed, and stores the number of values in *parsed; returns -1 on
+// a character that is neither a digit nor whitespace.
+long parseP2Values(const unsigned char* text, size_t len, unsigned char* out, long maxValues,
+                   unsigned int* hist, long* parsed) {
+    long n = 0;
+    size_t i = 0;
+    while (n < maxValues) {
+#ifdef __SSE2__
+        while (i + 16 <= len) {
+            unsigned int digits, spaces;
+            classifyP2Block(text + i, &digits, &spaces);
+            unsigned int other = ~spaces & 0xFFFF;
+            if (other) {
+                i += __builtin_ctz(other);
+                break;
+            }
+            i += 16;
+        }
+#endif
+        while (i < len && isP2Space(text[i])) i++;
+        if (i == len) break;
+        if (!isP2Digit(text[i])) return -1;
+
+        unsigned int value = 0;
+        while (i < len && isP2Digit(text[i])) {
+            value = value * 10 + (text[i++] - '0');
+        }
+        if (i < len && !isP2Space(text[i])) return -1;
+        out[n++] = (unsigned char)value;
+    }
+    if (hist) histogram_count(hist, out, (size_t)n);
+    *parsed = n;
+    return (long)i;
+}
+
+typedef struct {
+    const unsigned char* text;
+    size_t bounds[P2_MAX_SEGMENTS + 1]; // segment i is text[bounds[i], bounds[i + 1])
+    long first[P2_MAX_SEGMENTS + 1];    // index of the first value of each segment
+    long counts[P2_MAX_SEGMENTS];
+    long used[P2_MAX_SEGMENTS];         // bytes consumed by each segment
+    unsigned int hist[P2_MAX_SEGMENTS][256];
+    unsigned char* out;
+    long maxValues;
+    int withHist;
+} P2Job;
+
+static void countP2Task(void* ctx, int i) {
+    P2Job* job = (P2Job*)ctx;
+    job->counts[i] = countP2Values(job->text + job->bounds[i], job->bounds[i + 1] - job->bounds[i]);
+}
+
+static void parseP2Task(void* ctx, int i) {
+    P2Job* job = (P2Job*)ctx;
+    long want = job->maxValues - job->first[i];
+    if (want > job->counts[i]) want = job->counts[i];
+    long parsed;
+    memset(job->hist[i], 0, sizeof(job->hist[i]));
+    job->used[i] = parseP2Values(job->text + job->bounds[i], job->bounds[i + 1] - job->bounds[i],
+                                 job->out + job->first[i], want,
+                                 job->withHist ? job->hist[i] : NULL, &parsed);
+}
+
+// Same contract as parseP2Values. Large texts are split at whitespace into
+// one segment per thread: the segments are counted in parallel, their
+// first value indexes follow from the counts, and then they are parsed in
+// parallel straight into their place in out.
+long parseP2(const unsigned char* text, size_t len, unsigned char* out, long maxValues,
+             unsigned int* hist, long* parsed) {
+    int segments = parallel_threads();
+    if (segments > P2_MAX_SEGMENTS) segments = P2_MAX_SEGMENTS;
+    if (segments < 2 || len < P2_PARALLEL_BYTES) {
+        return parseP2Values(text, len, out, maxValues, hist, parsed);
+    }
+
+    P2Job* job = (P2Job*)malloc(sizeof(P2Job));
+    if (!job) return parseP2Values(text, len, out, maxValues, hist, parsed);
+    job->text = text;
+    job->out = out;
+    job->maxValues = maxValues;
+    job->withHist = hist != NULL;
+    job->bounds[0] = 0;
+    for (int i = 1; i < segments; i++) {
+        size_t b = len / segments * i;
+        if (b < job->bounds[i - 1]) b = job->bounds[i - 1];
+        while (b < len && !isP2Space(text[b])) b++;
+        job->bounds[i] = b;
+    }
+    job->bounds[segments] = len;
+
+    parallel_for(segments, countP2Task, job);
+    int used = 0; // segments that hold the values wanted
+    job->first[0] = 0;
+    for (int i = 0; i < segments; i++) {
+        if (job->counts[i] < 0) {
+            free(job);
+            return -1;
+        }
+        if (job->first[i] < maxValues) used = i + 1;
+        job->first[i + 1] = job->first[i] + job->counts[i];
+    }
+
+    parallel_for(used, parseP2Task, job);
+    long result = 0;
+    for (int i = 0; i < used; i++) {
+        if (job->used[i] < 0) {
+            free(job);
+            return -1;
+        }
+        for (int s = 0; hist && s < 256; s++) {
+            hist[s] += job->hist[i][s];
+        }
+    }
+    if (used > 0) {
+        long last = job->first[used - 1];
+        long want = maxValues - last < job->counts[used - 1] ? maxValues - last : job->counts[used - 1];
+        *parsed = last + want;
+        result = (long)job->bounds[used - 1] + job->used[used - 1];
+    } else {
+        *parsed = 0;
+        result = maxValues > 0 ? (long)len : 0; // nothing but whitespace
+    }
+    free(job);
+    return result;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef void (*ParallelTask)(void* ctx, int index);
+
+typedef struct {
+    ParallelTask task;
+    void* ctx;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+} ParallelJob;
+
+// Worker threads to use: SPL_THREADS if it is set, otherwise one per
+// online CPU.
+int parallel_threads(void) {
+    const char* env = getenv("SPL_THREADS");
+    int threads = env ? atoi(env) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    return threads > 0 ? threads : 1;
+}
+
+static void* parallel_worker(void* arg) {
+    ParallelJob* job = (ParallelJob*)arg;
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        int index = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (index >= job->count) break;
+        job->task(job->ctx, index);
+    }
+    return NULL;
+}
+
+// Runs task(ctx, i) for every i in [0, count) on a pool of worker threads
+// and returns once all of them are done. Tasks are handed out in index
+// order but may finish in any order, so each one must only write to its
+// own slot of the results. The calling thread works as one of the pool.
+void parallel_for(int count, ParallelTask task, void* ctx) {
+    int threads = parallel_threads();
+    if (threads > count) threads = count;
+
+    ParallelJob job;
+    job.task = task;
+    job.ctx = ctx;
+    job.count = count;
+    job.next = 0;
+    pthread_mutex_init(&job.lock, NULL);
+
+    pthread_t* ids = threads > 1 ? malloc((threads - 1) * sizeof(pthread_t)) : NULL;
+    int started = 0;
+    while (ids && started < threads - 1 &&
+           pthread_create(&ids[started], NULL, parallel_worker, &job) == 0) {
+        started++;
+    }
+    parallel_worker(&job);
+    for (int i = 0; i < started; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    free(ids);
+    pthread_mutex_destroy(&job.lock);
+}
+
+#endif
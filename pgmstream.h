@@ -0,0 +1,476 @@
+#ifndef PGMSTREAM_H
+#define PGMSTREAM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "histogram.h"
+#include "image.h"
+#include "mapfile.h"
+#include "p2parse.h"
+
+#define PGM_MAX_LINE 1024
+#define PGM_BATCH_BYTES (1 << 20) // pixels handed out per batch of rows
+#define PGM_TEXT_BYTES (4 << 20)  // P2 text read from the file at a time
+
+// Row-by-row PGM reader. The header is parsed up front and the pixels are
+// then read in batches of whole rows, so a codec only ever holds one batch
+// in memory. Rewinding goes back to the first row for a second pass. P5
+// files are memory-mapped and their rows handed out in place; P2 text is
+// read in large chunks and handed to parseP2. When hist is set, every
+// pixel read is also counted in it. "-" reads standard input; a stream
+// that cannot seek is read straight through, and keepPGMInput holds on to
+// it for codecs that need a second pass. Reading ahead overlaps the reads with
+// the codec: P2 batches are parsed on a reader thread while the codec
+// works on the one before, and the next P5 batch is paged in.
+typedef struct {
+    FILE* file;
+    PGMHeader pgm;
+    long dataStart;      // file offset of the first pixel
+    int seekable;        // the file can be rewound to dataStart
+    long rowsRead;
+    int binary;          // P5, else P2
+    MappedFile map;      // the whole P5 file
+    size_t mapPos;       // offset of the next P5 row in map
+    unsigned int* hist;
+    unsigned char* text; // P2 text not parsed yet is text[textPos, textLen)
+    size_t textPos;
+    size_t textLen;
+    int textEnd;         // the whole file has been read into text
+    int textKept;        // text holds all the pixels, so rewinding stays in memory
+    PipeReader* ahead;   // thread parsing P2 batches ahead, if any
+    long aheadRows;      // rows per batch read ahead, 0 if not reading ahead
+} PGMReader;
+
+int openPGMReader(PGMReader* r, const char* inputFile) {
+    r->file = open_input_stream(inputFile);
+    if (!r->file) {
+        printf("Cannot open the file");
+        return 1;
+    }
+
+    char line[PGM_MAX_LINE];
+    if (!readLine(r->file, line, PGM_MAX_LINE) || sscanf(line, "%2s", r->pgm.sign) != 1) {
+        printf("Failed to read magic number\n");
+        close_stream(r->file);
+        return 1;
+    }
+    if (!readLine(r->file, line, PGM_MAX_LINE) || sscanf(line, "%d %d", &r->pgm.width, &r->pgm.height) != 2) {
+        printf("Failed to read dimensions\n");
+        close_stream(r->file);
+        return 1;
+    }
+    if (!readLine(r->file, line, PGM_MAX_LINE) || sscanf(line, "%d", &r->pgm.maxIntensity) != 1) {
+        printf("Failed to read maxval\n");
+        close_stream(r->file);
+        return 1;
+    }
+    if ((strcmp(r->pgm.sign, "P2") != 0 && strcmp(r->pgm.sign, "P5") != 0) || r->pgm.maxIntensity > 255) {
+        printf("Unsupported PGM format: %s, maxval: %d\n", r->pgm.sign, r->pgm.maxIntensity);
+        close_stream(r->file);
+        return 1;
+    }
+    if (r->pgm.width <= 0 || r->pgm.height <= 0) {
+        printf("Invalid dimensions: %d x %d\n", r->pgm.width, r->pgm.height);
+        close_stream(r->file);
+        return 1;
+    }
+
+    r->binary = strcmp(r->pgm.sign, "P5") == 0;
+    r->dataStart = r->file == stdin ? -1 : ftell(r->file);
+    r->seekable = r->dataStart >= 0;
+    r->rowsRead = 0;
+    r->hist = NULL;
+    r->text = NULL;
+    r->textPos = r->textLen = 0;
+    r->textEnd = 0;
+    r->textKept = 0;
+    r->ahead = NULL;
+    r->aheadRows = 0;
+    r->map.data = NULL;
+    if (r->binary) {
+        if (map_file(&r->map, r->file) != 0) {
+            printf("Cannot read the file\n");
+            close_stream(r->file);
+            return 1;
+        }
+        r->mapPos = r->map.mapped ? (size_t)r->dataStart : 0; // else only the pixels were read
+    } else {
+        r->text = (unsigned char*)malloc(PGM_TEXT_BYTES);
+        if (!r->text) {
+            printf("Memory allocation failed\n");
+            close_stream(r->file);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Parses count P2 pixels into out, reading more text whenever the chunk
+// in memory runs out. Only text up to the last whitespace is parsed before
+// the end of the file, so no number is ever cut in two.
+static int readP2Pixels(PGMReader* r, unsigned char* out, long count) {
+    long got = 0;
+    while (got < count) {
+        size_t end = r->textLen;
+        while (!r->textEnd && end > r->textPos && !isP2Space(r->text[end - 1])) end--;
+        if (end > r->textPos) {
+            long parsed;
+            long used = parseP2(r->text + r->textPos, end - r->textPos, out + got, count - got, r->hist, &parsed);
+            if (used < 0) break;
+            r->textPos += used;
+            got += parsed;
+            if (got == count) break;
+        }
+        if (r->textEnd) break;
+
+        memmove(r->text, r->text + r->textPos, r->textLen - r->textPos);
+        r->textLen -= r->textPos;
+        r->textPos = 0;
+        if (r->textLen == PGM_TEXT_BYTES) break; // a single number filling the whole chunk
+        size_t n = fread(r->text + r->textLen, 1, PGM_TEXT_BYTES - r->textLen, r->file);
+        r->textLen += n;
+        if (n == 0) r->textEnd = 1;
+    }
+    if (got == count) return 0;
+    printf("Error reading P2 data at pixel %ld\n", r->rowsRead * r->pgm.width + got);
+    return 1;
+}
+
+// Rows per batch, so that a batch holds about PGM_BATCH_BYTES pixels.
+long pgmBatchRows(const PGMReader* r) {
+    long rows = PGM_BATCH_BYTES / r->pgm.width;
+    if (rows < 1) rows = 1;
+    return rows < r->pgm.height ? rows : r->pgm.height;
+}
+
+static long loadPGMRows(PGMReader* r, unsigned char* buffer, long maxRows, const unsigned char** rows) {
+    long left = r->pgm.height - r->rowsRead;
+    long n = maxRows < left ? maxRows : left;
+    long count = n * r->pgm.width;
+
+    if (r->binary) {
+        if (r->map.size - r->mapPos < (size_t)count) {
+            printf("Error reading P5 data\n");
+            return -1;
+        }
+        *rows = r->map.data + r->mapPos;
+        r->mapPos += count;
+        if (r->aheadRows) map_file_prefetch(&r->map, r->mapPos, (size_t)r->aheadRows * r->pgm.width);
+        if (r->hist) histogram_count_rows(r->hist, *rows, r->pgm.width, r->pgm.width, n);
+    } else if (readP2Pixels(r, buffer, count) != 0) {
+        return -1;
+    } else {
+        *rows = buffer;
+    }
+    r->rowsRead += n;
+    return n;
+}
+
+static long readAheadTask(void* ctx, unsigned char* buffer) {
+    PGMReader* r = (PGMReader*)ctx;
+    const unsigned char* rows;
+    return loadPGMRows(r, buffer, r->aheadRows, &rows);
+}
+
+// Reads batches of batchRows rows ahead of the codec from here on, until
+// the reader is rewound or closed. Only one batch at a time is held up by
+// the codec, so at most PIPE_DEPTH batches are in memory. If the thread
+// cannot be started the rows are just read as they are asked for.
+void startPGMReadAhead(PGMReader* r, long batchRows) {
+    r->aheadRows = batchRows;
+    if (r->binary) return;
+    r->ahead = (PipeReader*)malloc(sizeof(PipeReader));
+    if (r->ahead && pipe_reader_start(r->ahead, readAheadTask, r, (size_t)batchRows * r->pgm.width) != 0) {
+        free(r->ahead);
+        r->ahead = NULL;
+    }
+}
+
+static void stopPGMReadAhead(PGMReader* r) {
+    if (r->ahead) {
+        pipe_reader_stop(r->ahead);
+        free(r->ahead);
+        r->ahead = NULL;
+    }
+    r->aheadRows = 0;
+}
+
+// Hands out up to maxRows rows, or the batch read ahead when reading
+// ahead. *rows points straight into the mapped file for P5 and at the
+// parsed pixels for P2, in buffer or in a read-ahead buffer; either way it
+// stays valid until the next call. Returns the number of rows, 0 once the
+// image is done, or -1 on a read error.
+long viewPGMRows(PGMReader* r, unsigned char* buffer, long maxRows, const unsigned char** rows) {
+    if (r->ahead) {
+        unsigned char* data = NULL;
+        long n = pipe_reader_next(r->ahead, &data);
+        *rows = data;
+        return n;
+    }
+    return loadPGMRows(r, buffer, maxRows, rows);
+}
+
+// Same as viewPGMRows, but the rows always end up in rows.
+long readPGMRows(PGMReader* r, unsigned char* rows, long maxRows) {
+    const unsigned char* view;
+    long n = viewPGMRows(r, rows, maxRows, &view);
+    if (n > 0 && view != rows) memcpy(rows, view, n * r->pgm.width);
+    return n;
+}
+
+// Makes sure the pixels can be read more than once: P2 text from a stream
+// that cannot seek is read into memory in full. P5 pixels already are.
+int keepPGMInput(PGMReader* r) {
+    if (r->binary || r->seekable || r->textKept) return 0;
+    size_t len;
+    unsigned char* text = read_remaining(r->file, &len);
+    if (!text) {
+        printf("Cannot read the file\n");
+        return 1;
+    }
+    free(r->text);
+    r->text = text;
+    r->textPos = 0;
+    r->textLen = len;
+    r->textEnd = 1;
+    r->textKept = 1;
+    return 0;
+}
+
+// Goes back to the first row for another pass over the pixels. Reading
+// ahead stops, so that hist can be changed before the next pass.
+int rewindPGMReader(PGMReader* r) {
+    stopPGMReadAhead(r);
+    r->rowsRead = 0;
+    r->mapPos = r->map.mapped ? (size_t)r->dataStart : 0;
+    r->textPos = 0;
+    if (r->binary || r->textKept) return 0;
+    r->textLen = 0;
+    r->textEnd = 0;
+    return r->seekable && fseek(r->file, r->dataStart, SEEK_SET) == 0 ? 0 : 1;
+}
+
+// Size of the whole input file, for the compression report, or -1 if it
+// is not known.
+long pgmFileSize(PGMReader* r) {
+    if (r->binary && r->map.mapped) return (long)r->map.size;
+    if (!r->seekable) return -1;
+    long pos = ftell(r->file);
+    fseek(r->file, 0, SEEK_END);
+    long size = ftell(r->file);
+    fseek(r->file, pos, SEEK_SET);
+    return size;
+}
+
+void closePGMReader(PGMReader* r) {
+    stopPGMReadAhead(r);
+    free(r->text);
+    if (r->binary) unmap_file(&r->map);
+    close_stream(r->file);
+}
+
+#define PGM_WRITE_BYTES (8 << 20) // P2 text formatted per block of rows
+
+// Decimal text of every pixel value followed by a space, padded to four
+// bytes so a pixel is always one fixed-size copy.
+typedef struct {
+    unsigned char text[256][4];
+    unsigned char length[256];
+} P2Digits;
+
+static const P2Digits* p2Digits(void) {
+    static P2Digits digits;
+    static int ready = 0;
+    if (!ready) {
+        for (int v = 0; v < 256; v++) {
+            char buf[8];
+            int n = snprintf(buf, sizeof(buf), "%d ", v);
+            memcpy(digits.text[v], buf, 4);
+            digits.length[v] = (unsigned char)n;
+        }
+        ready = 1;
+    }
+    return &digits;
+}
+
+typedef struct {
+    const P2Digits* digits;
+    const unsigned char* pixels; // first row of the block
+    unsigned char* text;
+    long width;
+    long rows;
+    long rowsPerRange;
+    size_t* lengths;             // text written by each range
+} P2WriteJob;
+
+// Formats a range of rows into its own slice of the text buffer: values
+// separated by a space and every row ended by a newline.
+static void formatP2Task(void* ctx, int i) {
+    P2WriteJob* job = (P2WriteJob*)ctx;
+    long first = (long)i * job->rowsPerRange;
+    long last = first + job->rowsPerRange < job->rows ? first + job->rowsPerRange : job->rows;
+    unsigned char* start = job->text + (size_t)first * job->width * 4;
+    unsigned char* p = start;
+    for (long y = first; y < last; y++) {
+        const unsigned char* row = job->pixels + (size_t)y * job->width;
+        for (long x = 0; x < job->width; x++) {
+            memcpy(p, job->digits->text[row[x]], 4);
+            p += job->digits->length[row[x]];
+        }
+        p[-1] = '\n';
+    }
+    job->lengths[i] = (size_t)(p - start);
+}
+
+// Writes a whole image: the text header, then the pixels as P2 text or P5
+// bytes depending on pgm->sign. P2 text is formatted from a digit table a
+// block of rows at a time, with the rows of a large block split across
+// the thread pool, and reaches the file in a few large writes.
+int writePGM(FILE* output, const PGMHeader* pgm, const unsigned char* pixels) {
+    long tP = (long)pgm->width * pgm->height; // totalPixels
+    fprintf(output, "%s\n%d %d\n%d\n", pgm->sign, pgm->width, pgm->height, pgm->maxIntensity);
+    if (strcmp(pgm->sign, "P5") == 0) {
+        if (fwrite(pixels, 1, tP, output) != (size_t)tP) {
+            printf("Error writing P5 data\n");
+            return 1;
+        }
+        return 0;
+    }
+    if (strcmp(pgm->sign, "P2") != 0) {
+        printf("Invalid format in compressed file: %s\n", pgm->sign);
+        return 1;
+    }
+    if (tP == 0) return 0;
+
+    long width = pgm->width;
+    long blockRows = PGM_WRITE_BYTES / (width * 4);
+    if (blockRows < 1) blockRows = 1;
+    if (blockRows > pgm->height) blockRows = pgm->height;
+    int ranges = blockRows * width * 4 >= P2_PARALLEL_BYTES ? parallel_threads() : 1;
+    if (ranges > blockRows) ranges = (int)blockRows;
+
+    P2WriteJob job;
+    job.digits = p2Digits();
+    job.width = width;
+    job.text = (unsigned char*)malloc((size_t)blockRows * width * 4);
+    job.lengths = (size_t*)malloc(ranges * sizeof(size_t));
+    if (!job.text || !job.lengths) {
+        printf("Memory allocation failed\n");
+        free(job.text);
+        free(job.lengths);
+        return 1;
+    }
+
+    int failed = 0;
+    for (long y = 0; y < pgm->height && !failed; y += blockRows) {
+        job.pixels = pixels + (size_t)y * width;
+        job.rows = pgm->height - y < blockRows ? pgm->height - y : blockRows;
+        job.rowsPerRange = (job.rows + ranges - 1) / ranges;
+        int used = (int)((job.rows + job.rowsPerRange - 1) / job.rowsPerRange);
+        parallel_for(used, formatP2Task, &job);
+        for (int i = 0; i < used && !failed; i++) {
+            unsigned char* start = job.text + (size_t)i * job.rowsPerRange * width * 4;
+            failed = fwrite(start, 1, job.lengths[i], output) != job.lengths[i];
+        }
+    }
+    free(job.text);
+    free(job.lengths);
+    if (failed) {
+        printf("Error writing P2 data\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Destination of a decoded image. A P5 image is decoded straight into the
+// output file, preallocated and mapped with its header already written,
+// or passed on a window at a time where it cannot be mapped. P2 text
+// depends on the pixel values, so P2 pixels are decoded to the heap and
+// formatted by writePGM once decoding is done.
+typedef struct {
+    PGMHeader pgm;
+    const char* path;
+    MappedSink sink;
+    unsigned char* pixels; // P2 pixels
+    long headerLen; // P5 bytes before the pixels
+    int binary;
+} PGMOutput;
+
+int openPGMOutput(PGMOutput* o, const char* outputFile, const PGMHeader* pgm) {
+    long tP = (long)pgm->width * pgm->height; // totalPixels
+    o->pgm = *pgm;
+    o->path = outputFile;
+    o->binary = strcmp(pgm->sign, "P2") != 0;
+    if (!o->binary) {
+        o->pixels = (unsigned char*)malloc(tP ? tP : 1);
+        if (!o->pixels) {
+            printf("Memory allocation failed\n");
+            return 1;
+        }
+        return 0;
+    }
+    if (strcmp(pgm->sign, "P5") != 0) {
+        printf("Invalid format in compressed file: %s\n", pgm->sign);
+        return 1;
+    }
+
+    char header[64];
+    int headerLen = snprintf(header, sizeof(header), "%s\n%d %d\n%d\n",
+                             pgm->sign, pgm->width, pgm->height, pgm->maxIntensity);
+    if (map_sink_open(&o->sink, outputFile, (size_t)headerLen + tP) != 0) {
+        printf("Cannot create output file: %s\n", outputFile);
+        return 1;
+    }
+    // With the header goes the first row, so any single row fits later on
+    unsigned char* head = map_sink_reserve(&o->sink, 0, (size_t)headerLen + pgm->width);
+    if (!head) {
+        printf("Memory allocation failed\n");
+        map_sink_abort(&o->sink);
+        return 1;
+    }
+    memcpy(head, header, headerLen);
+    o->headerLen = headerLen;
+    return 0;
+}
+
+// Where pixels first .. first + count - 1 go, or NULL if there is no
+// memory for them. Pixels are asked for in order; asking for first says
+// the ones before it are done. Up to a row always fits.
+unsigned char* pgmOutputPixels(PGMOutput* o, long first, long count) {
+    if (!o->binary) return o->pixels + first;
+    return map_sink_reserve(&o->sink, (size_t)(o->headerLen + first), (size_t)count);
+}
+
+// Writes out a fully decoded image. Returns 0, or 1 on a write error.
+int closePGMOutput(PGMOutput* o) {
+    if (o->binary) {
+        if (map_sink_close(&o->sink) != 0) {
+            printf("Error writing P5 data\n");
+            return 1;
+        }
+        return 0;
+    }
+    FILE* output = open_output_stream(o->path);
+    if (!output) {
+        printf("Cannot create output file: %s\n", o->path);
+        free(o->pixels);
+        return 1;
+    }
+    int failed = writePGM(output, &o->pgm, o->pixels);
+    fclose(output);
+    free(o->pixels);
+    return failed;
+}
+
+// Drops the output of a decode that failed.
+void discardPGMOutput(PGMOutput* o) {
+    if (o->binary) {
+        map_sink_abort(&o->sink);
+        if (!is_std_stream(o->path)) remove(o->path);
+    } else {
+        free(o->pixels);
+    }
+}
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PIPE_DEPTH 4 // buffers in flight between two stages
+
+// Bounded queue between two pipeline stages: a ring of PIPE_DEPTH buffers
+// owned by the queue. The producer fills the slot it reserved outside the
+// lock and publishes it; the consumer takes the oldest full slot and
+// releases it once done with it. A full queue blocks the producer and an
+// empty one the consumer, so neither stage runs more than PIPE_DEPTH
+// buffers ahead. Closing tells the other side there is nothing more to
+// come, or nothing more wanted.
+typedef struct {
+    unsigned char* slot[PIPE_DEPTH];
+    long length[PIPE_DEPTH];
+    int head;   // oldest full slot
+    int count;  // full slots
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} PipeQueue;
+
+int pipe_queue_init(PipeQueue* q, size_t slotBytes) {
+    q->head = q->count = q->closed = 0;
+    for (int i = 0; i < PIPE_DEPTH; i++) {
+        q->slot[i] = (unsigned char*)malloc(slotBytes);
+        if (!q->slot[i]) {
+            while (i-- > 0) free(q->slot[i]);
+            return -1;
+        }
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->changed, NULL);
+    return 0;
+}
+
+void pipe_queue_free(PipeQueue* q) {
+    for (int i = 0; i < PIPE_DEPTH; i++) free(q->slot[i]);
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->changed);
+}
+
+// Waits for an empty slot and returns it, or NULL once the queue is closed.
+unsigned char* pipe_queue_reserve(PipeQueue* q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == PIPE_DEPTH && !q->closed) pthread_cond_wait(&q->changed, &q->lock);
+    unsigned char* slot = q->closed ? NULL : q->slot[(q->head + q->count) % PIPE_DEPTH];
+    pthread_mutex_unlock(&q->lock);
+    return slot;
+}
+
+// Hands the reserved slot, holding length, to the consumer.
+void pipe_queue_publish(PipeQueue* q, long length) {
+    pthread_mutex_lock(&q->lock);
+    q->length[(q->head + q->count) % PIPE_DEPTH] = length;
+    q->count++;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Waits for the oldest full slot and returns its length, or 0 once the
+// queue is closed and empty.
+long pipe_queue_take(PipeQueue* q, unsigned char** data) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->closed) pthread_cond_wait(&q->changed, &q->lock);
+    long length = 0;
+    if (q->count > 0) {
+        *data = q->slot[q->head];
+        length = q->length[q->head];
+    }
+    pthread_mutex_unlock(&q->lock);
+    return length;
+}
+
+// Gives the slot last taken back to the producer.
+void pipe_queue_release(PipeQueue* q) {
+    pthread_mutex_lock(&q->lock);
+    q->head = (q->head + 1) % PIPE_DEPTH;
+    q->count--;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Waits until the consumer has released every full slot.
+void pipe_queue_drain(PipeQueue* q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count > 0) pthread_cond_wait(&q->changed, &q->lock);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void pipe_queue_close(PipeQueue* q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Writer stage: buffers published to the queue are written to the file in
+// order on a thread of their own, so the encoder goes on filling the next
+// buffer while the last one is on its way to the disk. A write error is
+// remembered and the rest of the buffers are dropped.
+typedef struct {
+    PipeQueue queue;
+    FILE* file;
+    pthread_t thread;
+    int error;
+} PipeWriter;
+
+static void* pipe_writer_main(void* arg) {
+    PipeWriter* w = (PipeWriter*)arg;
+    unsigned char* data;
+    long length;
+    while ((length = pipe_queue_take(&w->queue, &data)) > 0) {
+        if (!w->error && fwrite(data, 1, (size_t)length, w->file) != (size_t)length) w->error = 1;
+        pipe_queue_release(&w->queue);
+    }
+    return NULL;
+}
+
+int pipe_writer_start(PipeWriter* w, FILE* file, size_t slotBytes) {
+    w->file = file;
+    w->error = 0;
+    if (pipe_queue_init(&w->queue, slotBytes) != 0) return -1;
+    if (pthread_create(&w->thread, NULL, pipe_writer_main, w) != 0) {
+        pipe_queue_free(&w->queue);
+        return -1;
+    }
+    return 0;
+}
+
+// Writes out everything published so far and stops the thread. Returns -1
+// if any of it could not be written.
+int pipe_writer_finish(PipeWriter* w) {
+    pipe_queue_close(&w->queue);
+    pthread_join(w->thread, NULL);
+    pipe_queue_free(&w->queue);
+    return w->error ? -1 : 0;
+}
+
+// Reader stage: produce(ctx, buffer) is called over and over on a thread
+// of its own to fill buffers ahead of the consumer. It returns how much it
+// put in the buffer, 0 at the end or -1 on an error, which is passed on to
+// the consumer as the last buffer.
+typedef long (*PipeProduce)(void* ctx, unsigned char* buffer);
+
+typedef struct {
+    PipeQueue queue;
+    PipeProduce produce;
+    void* ctx;
+    pthread_t thread;
+    int held; // the consumer holds a slot
+} PipeReader;
+
+static void* pipe_reader_main(void* arg) {
+    PipeReader* r = (PipeReader*)arg;
+    unsigned char* buffer;
+    while ((buffer = pipe_queue_reserve(&r->queue)) != NULL) {
+        long length = r->produce(r->ctx, buffer);
+        if (length != 0) pipe_queue_publish(&r->queue, length);
+        if (length <= 0) break;
+    }
+    pipe_queue_close(&r->queue);
+    return NULL;
+}
+
+int pipe_reader_start(PipeReader* r, PipeProduce produce, void* ctx, size_t slotBytes) {
+    r->produce = produce;
+    r->ctx = ctx;
+    r->held = 0;
+    if (pipe_queue_init(&r->queue, slotBytes) != 0) return -1;
+    if (pthread_create(&r->thread, NULL, pipe_reader_main, r) != 0) {
+        pipe_queue_free(&r->queue);
+        return -1;
+    }
+    return 0;
+}
+
+// Gives back the previous buffer and waits for the next one. Returns what
+// produce returned for it; *data stays valid until the next call.
+long pipe_reader_next(PipeReader* r, unsigned char** data) {
+    if (r->held) pipe_queue_release(&r->queue);
+    long length = pipe_queue_take(&r->queue, data);
+    r->held = length != 0;
+    return length;
+}
+
+// Stops the thread, even if the consumer did not read to the end.
+void pipe_reader_stop(PipeReader* r) {
+    pipe_queue_close(&r->queue);
+    pthread_join(r->thread, NULL);
+    pipe_queue_free(&r->queue);
+}
+
+#endif
@@ -2,129 +2,90 @@
 #include <stdlib.h>
 #include <string.h>
 #include "image.h"
+#include "pgmstream.h"
 
-#define MAX_SIZE 256
-#define MAX_LINE 1024
 
 int compressRLE(const char* inputFile, const char* outputFile) {
-    FILE* input = fopen(inputFile, "rb");
-    FILE* output = fopen(outputFile, "wb");
-    if (!input || !output) {
-        printf("Cannot open the file");
-        return 1;
-    }
-
-    PGMHeader pgm;
-    char line[MAX_LINE];
-    if (!readLine(input, line, MAX_LINE) || sscanf(line, "%2s", pgm.sign) != 1) {
-        printf("Failed to read magic number\n");
-        fclose(input);
-        fclose(output);
-        return 1;
-    }
-    
-    if (!readLine(input, line, MAX_LINE) || sscanf(line, "%d %d", &pgm.width, &pgm.height) != 2) {
-        printf("Failed to read dimensions from line: %s", line);
-        fclose(input);
-        fclose(output);
-        return 1;
-    }
-    
-    if (!readLine(input, line, MAX_LINE) || sscanf(line, "%d", &pgm.maxIntensity) != 1) {
-        printf("Failed to read maxval\n");
-        fclose(input);
-        fclose(output);
+    PGMReader reader;
+    if (openPGMReader(&reader, inputFile) != 0) {
         return 1;
     }
-
-    if ((strcmp(pgm.sign, "P2") != 0 && strcmp(pgm.sign, "P5") != 0) || pgm.maxIntensity > 255) {
-        printf("Unsupported PGM format: %s, maxvalue: %d\n", pgm.sign, pgm.maxIntensity);
-        fclose(input);
-        fclose(output);
+    FILE* output = open_output_stream(outputFile);
+    if (!output) {
+        printf("Cannot open the file");
+        closePGMReader(&reader);
         return 1;
     }
+    PGMHeader pgm = reader.pgm;
+    long size = pgmFileSize(&reader);
 
-    long tP = (long)pgm.width * pgm.height; //totalPixels
-    unsigned char* iD = (unsigned char*)malloc(tP); //imageData
+    long bR = pgmBatchRows(&reader); // batchRows
+    unsigned char* iD = (unsigned char*)malloc(bR * pgm.width); //imageData, one batch of rows
     if (!iD) {
         printf("Memory allocation failed\n");
-        fclose(input);
+        closePGMReader(&reader);
         fclose(output);
         return 1;
     }
 
-    if (strcmp(pgm.sign, "P2") == 0) {
-        for (long i = 0; i < tP; i++) {
-            int pixel;
-            if (fscanf(input, "%d", &pixel) != 1) {
-                printf("Error reading P2 data at pixel %ld\n", i);
-                free(iD);
-                fclose(input);
-                fclose(output);
-                return 1;
-            }
-            iD[i] = (unsigned char)pixel;
-        }
-    } else {
-        if (fread(iD, 1, tP, input) != tP) {
-            printf("Error reading P5 data: expected %ld bytes\n", tP);
-            free(iD);
-            fclose(input);
-            fclose(output);
-            return 1;
-        }
-    }
-    fseek(input, 0, SEEK_END);
-    long size = ftell(input);
-    fseek(input, sizeof(pgm), SEEK_SET);
-    fclose(input);
-
     fwrite(&pgm.width, sizeof(int), 1, output);
     fwrite(&pgm.height, sizeof(int), 1, output);
     fwrite(pgm.sign, sizeof(char), 2, output);
 
-    unsigned char current = iD[0];
-    unsigned char count = 1;
-    
-    for (long i = 1; i < tP; i++) {
-        if (iD[i] == current && count < 255) {
-            count++;
-        } else {
-            if (fwrite(&current, sizeof(unsigned char), 1, output) != 1 ||
-                fwrite(&count, sizeof(unsigned char), 1, output) != 1) {
-                printf("Error writing RLE pair\n");
-                free(iD);
-                fclose(output);
-                return 1;
+    BitWriter bw;
+    if (bit_writer_init(&bw, output) != 0) {
+        printf("Memory allocation failed\n");
+        free(iD);
+        closePGMReader(&reader);
+        fclose(output);
+        return 1;
+    }
+
+    // Runs carry over from one batch to the next. Each pair is a value
+    // byte and a count byte.
+    unsigned char current = 0;
+    unsigned char count = 0;
+    long rows;
+    const unsigned char* view;
+    startPGMReadAhead(&reader, bR);
+    while ((rows = viewPGMRows(&reader, iD, bR, &view)) > 0) {
+        long n = rows * pgm.width;
+        for (long i = 0; i < n; i++) {
+            if (count > 0 && view[i] == current && count < 255) {
+                count++;
+                continue;
             }
-            current = iD[i];
+            if (count > 0) bit_writer_put(&bw, (current << 8) | count, 16);
+            current = view[i];
             count = 1;
         }
     }
-    if (fwrite(&current, sizeof(unsigned char), 1, output) != 1 ||
-        fwrite(&count, sizeof(unsigned char), 1, output) != 1) {
-        printf("Error writing final RLE pair\n");
+    closePGMReader(&reader);
+    if (rows < 0) {
+        bit_writer_free(&bw);
+        free(iD);
+        fclose(output);
+        return 1;
+    }
+    bit_writer_put(&bw, (current << 8) | count, 16);
+    if (bit_writer_flush(&bw) != 0) {
+        printf("Error writing RLE pairs\n");
+        bit_writer_free(&bw);
         free(iD);
         fclose(output);
         return 1;
     }
+    bit_writer_free(&bw);
+    long compressedSize = stream_size(output);
     fclose(output);
     free(iD);
 
-    printf("Original size: %ld bytes\n", size);
-
-    FILE *check_size = fopen(outputFile, "rb");
-    fseek(check_size, 0, SEEK_END);
-    long compressed_size = ftell(check_size);
-    fclose(check_size);
-    
-    printf("Compressed size: %ld bytes\n", compressed_size);
-    printf("Compression ratio: %.2f%%\n",  (1.0 - ((float)compressed_size / size)) * 100); 
+    print_compression_report(size, compressedSize);
     return 0;
 }
 
 int decompressRLE(const char* inputFile, const char* outputFile) {
-    FILE* input = fopen(inputFile, "rb");
+    FILE* input = open_input_stream(inputFile);
     if (!input) {
         printf("Cannot open input file: %s\n", inputFile);
         return 1;
@@ -135,20 +96,18 @@ int decompressRLE(const char* inputFile, const char* outputFile) {
         fread(&pgm.height, sizeof(int), 1, input) != 1 ||
         fread(pgm.sign, sizeof(char), 2, input) != 2) {
         printf("Failed to read header from %s\n", inputFile);
-        fclose(input);
+        close_stream(input);
         return 1;
     }
     pgm.sign[2] = '\0';
     pgm.maxIntensity = 255;
 
     long tP = (long)pgm.width * pgm.height;
-    unsigned char* dD = (unsigned char*)malloc(tP);
-    if (!dD) {
-        printf("Memory allocation failed\n");
-        fclose(input);
+    PGMOutput out;
+    if (openPGMOutput(&out, outputFile, &pgm) != 0) {
+        close_stream(input);
         return 1;
     }
-
     unsigned char value;
     unsigned char count;
     long pixelsWritten = 0;
@@ -157,68 +116,30 @@ int decompressRLE(const char* inputFile, const char* outputFile) {
         if (fread(&value, sizeof(unsigned char), 1, input) != 1 ||
             fread(&count, sizeof(unsigned char), 1, input) != 1) {
             printf("Error reading RLE pair at pixel %ld\n", pixelsWritten);
-            free(dD);
-            fclose(input);
+            discardPGMOutput(&out);
+            close_stream(input);
             return 1;
         }
-        for (int i = 0; i < count && pixelsWritten < tP; i++) {
-            dD[pixelsWritten++] = value;
-        }
+        // A run is short enough to always fit in the output window
+        long n = count < tP - pixelsWritten ? count : tP - pixelsWritten;
+        memset(pgmOutputPixels(&out, pixelsWritten, n), value, n);
+        pixelsWritten += n;
     }
-    fclose(input);
+    close_stream(input);
 
     if (pixelsWritten != tP) {
         printf("Error: Decompressed pixel count (%ld) doesn't match expected (%ld)\n",
                pixelsWritten, tP);
-        free(dD);
-        return 1;
-    }
-
-    FILE* output = fopen(outputFile, "wb");
-    if (!output) {
-        printf("Cannot create output file: %s\n", outputFile);
-        free(dD);
+        discardPGMOutput(&out);
         return 1;
     }
 
-    fprintf(output, "%s\n%d %d\n%d\n", pgm.sign, pgm.width, pgm.height, pgm.maxIntensity);
-
-    if (strcmp(pgm.sign, "P2") == 0) {
-        for (long i = 0; i < tP; i++) {
-            if (fprintf(output, "%d", dD[i]) < 0) {
-                printf("Error writing P2 data at pixel %ld\n", i);
-                fclose(output);
-                free(dD);
-                return 1;
-            }
-            if ((i + 1) % pgm.width == 0) {
-                fprintf(output, "\n");
-            } else {
-                fprintf(output, " ");
-            }
-        }
-    } else if (strcmp(pgm.sign, "P5") == 0) {
-        if (fwrite(dD, 1, tP, output) != tP) {
-            printf("Error writing P5 data\n");
-            fclose(output);
-            free(dD);
-            return 1;
-        }
-    } else {
-        printf("Invalid format in compressed file: %s\n", pgm.sign);
-        fclose(output);
-        free(dD);
-        return 1;
-    }
-
-    fclose(output);
-    free(dD);
-    return 0;
+    return closePGMOutput(&out);
 }
 
 int rle() {
     char inputFile[256];
-    char compressedFile[256] = "compressed.bin";
+    char compressedFile[256];
     char decompressedFile[256];
     int yn;
 
@@ -231,6 +152,10 @@ int rle() {
         scanf("%255s", inputFile);
         printf("\n");
 
+        printf("Enter the compressed file name: ");
+        scanf("%255s", compressedFile);
+        printf("\n");
+
         printf("Attempting to compress %s...\n", inputFile);
         printf("\n");
         if (compressRLE(inputFile, compressedFile) == 0) {
@@ -241,6 +166,9 @@ int rle() {
         }
     }
     else if(yn == 2){ 
+        printf("Enter the compressed file name: ");
+        scanf("%255s", compressedFile);
+        printf("\n");
         printf("Enter decompressed PGM file name: ");
         scanf("%255s", decompressedFile);
         printf("\n");
@@ -251,18 +179,10 @@ int rle() {
         if (decompressRLE(compressedFile, decompressedFile) == 0) {
             printf("Decompression successful: %s -> %s\n", compressedFile, decompressedFile);
 
-            FILE* comp = fopen(compressedFile, "rb");
-            fseek(comp, 0, SEEK_END);
-            long compSize = ftell(comp);
-            fclose(comp);
-        
-            FILE* decomp = fopen(decompressedFile, "rb");
-            fseek(decomp, 0, SEEK_END);
-            long decompSize = ftell(decomp);
-            fclose(decomp);
-
-            printf("Compressed size: %ld bytes\n", compSize);
-            printf("Decompressed size: %ld bytes\n", decompSize);
+            long compSize = path_size(compressedFile);
+            long decompSize = path_size(decompressedFile);
+            if (compSize >= 0) printf("Compressed size: %ld bytes\n", compSize);
+            if (decompSize >= 0) printf("Decompressed size: %ld bytes\n", decompSize);
         } else {
             printf("Decompression failed\n");
         }
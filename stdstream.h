@@ -0,0 +1,77 @@
+#ifndef STDSTREAM_H
+#define STDSTREAM_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // fdopen and fileno are POSIX
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// "-" as a file name stands for standard input or standard output, so the
+// tool can sit in a shell pipeline without temporary files. Such streams
+// are read and written strictly in order and never seeked.
+static inline int is_std_stream(const char* path) {
+    return strcmp(path, "-") == 0;
+}
+
+// Returns a new descriptor for the data going to standard output. The
+// first time, descriptor 1 is pointed at stderr, so every message printed
+// from then on goes there instead of into the data.
+int claim_stdout(void) {
+    static int data = -1;
+    if (data < 0) {
+        fflush(stdout);
+        data = dup(STDOUT_FILENO);
+        if (data < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) return -1;
+    }
+    return dup(data);
+}
+
+FILE* open_input_stream(const char* path) {
+    return is_std_stream(path) ? stdin : fopen(path, "rb");
+}
+
+FILE* open_output_stream(const char* path) {
+    if (!is_std_stream(path)) return fopen(path, "wb");
+    int fd = claim_stdout();
+    FILE* file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!file && fd >= 0) close(fd);
+    return file;
+}
+
+// Closes a stream from open_input_stream or open_output_stream. Standard
+// input is left open.
+int close_stream(FILE* file) {
+    return file == stdin ? 0 : fclose(file);
+}
+
+// Bytes written to an output stream so far, or -1 for a pipe.
+long stream_size(FILE* file) {
+    fflush(file);
+    return ftell(file);
+}
+
+// Size of a file by name, or -1 for standard input or output and for
+// anything else that cannot be measured.
+long path_size(const char* path) {
+    if (is_std_stream(path)) return -1;
+    FILE* file = fopen(path, "rb");
+    if (!file) return -1;
+    long size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    fclose(file);
+    return size;
+}
+
+// Prints what the compressors report. A size of -1 is not known, as for a
+// pipe, and is left out.
+void print_compression_report(long original, long compressed) {
+    if (original >= 0) printf("Original size: %ld bytes\n", original);
+    if (compressed >= 0) printf("Compressed size: %ld bytes\n", compressed);
+    if (original > 0 && compressed >= 0) {
+        printf("Compression ratio: %.2f%%\n", (1.0 - ((float)compressed / original)) * 100);
+    }
+}
+
+#endif